@@ -55,5 +55,11 @@ extern strid_t glkunix_stream_open_pathname_gen(char *pathname,
 extern strid_t glkunix_stream_open_pathname(char *pathname, glui32 textmode, 
     glui32 rock);
 
+/* GlkTerm only: save and restore the display state, for interpreters
+    which autosave. See gtsnap.c. */
+#define GLKUNIX_LIBRARY_STATE
+extern glui32 glkunix_save_library_state(strid_t str);
+extern glui32 glkunix_load_library_state(strid_t str);
+
 #endif /* GT_START_H */
 
@@ -38,6 +38,28 @@ typedef struct glk_window_struct window_t;
 typedef struct glk_stream_struct stream_t;
 typedef struct glk_fileref_struct fileref_t;
 
+/* An allocation pool for one class of object. See gtpool.c. Each pooled
+    struct has a glui32 field giving its position in the live array, and
+    a glui32 field giving the generation of its slot. */
+typedef struct gli_pool_struct {
+    int objsize; /* sizeof the object struct */
+    int indexoffset; /* offsetof its position field */
+    int genoffset; /* offsetof its generation field */
+    void **live; /* live objects, in creation order, with NULL holes */
+    glui32 numlive, numused, livesize;
+    void **freeslots; /* ring of released slots, oldest first */
+    glui32 freehead, numfree, freesize;
+    glui32 numslots; /* slots carved out of slabs, live or free */
+    char *slab; /* the slab currently being carved up */
+    glui32 slabused, slabobjs;
+} gli_pool_t;
+
+/* A static initializer for a pool. The file using this must include
+    stddef.h. */
+#define GLI_POOL_INIT(type, field, genfield)  \
+    { sizeof(type), offsetof(type, field), offsetof(type, genfield), \
+        NULL, 0, 0, 0, NULL, 0, 0, 0, 0, NULL, 0, 0 }
+
 #define MAGIC_WINDOW_NUM (9826)
 #define MAGIC_STREAM_NUM (8269)
 #define MAGIC_FILEREF_NUM (6982)
@@ -48,6 +70,7 @@ struct glk_window_struct {
     glui32 type;
     
     grect_t bbox; /* content rectangle, excluding borders */
+    int moved; /* bbox has changed since the window was last drawn */
     window_t *parent; /* pair window which contains this one */
     void *data; /* one of the window_*_t structures */
     
@@ -64,21 +87,60 @@ struct glk_window_struct {
 
     glui32 style;
     
+    int inputindex; /* position in the input index, or -1 */
+    glui32 treerank; /* position in tree order, as of the last ranking */
+    
     gidispatch_rock_t disprock;
-    window_t *next, *prev; /* in the big linked list of windows */
+    glui32 poolindex; /* position in the list of live windows */
+    glui32 poolgen; /* generation of this slot; see gtpool.c */
 };
 
+/* Handle checks for the Glk API entry points. These are safe even for a
+    handle which has been closed, because pooled objects are never freed;
+    closing an object clears its magic number. */
+#define gli_window_valid(win)  \
+    ((win) && (win)->magicnum == MAGIC_WINDOW_NUM)
+#define gli_stream_valid(str)  \
+    ((str) && (str)->magicnum == MAGIC_STREAM_NUM)
+#define gli_fileref_valid(fref)  \
+    ((fref) && (fref)->magicnum == MAGIC_FILEREF_NUM)
+
 #define strtype_File (1)
 #define strtype_Window (2)
 #define strtype_Memory (3)
 #define strtype_Resource (4)
 
+/* The functions that do the real work for one kind of stream. Each
+    stream points at the table for its kind, chosen when it is opened,
+    so the put and get calls don't have to sort out the stream type on
+    every character. See gtstream.c. */
+typedef struct gli_stream_ops_struct {
+    void (*put_char)(stream_t *str, glui32 ch);
+    void (*put_buffer)(stream_t *str, char *buf, glui32 len);
+    void (*put_buffer_uni)(stream_t *str, glui32 *buf, glui32 len);
+    glsi32 (*get_char)(stream_t *str, int want_unicode);
+    glui32 (*get_buffer)(stream_t *str, char *cbuf, glui32 *ubuf, 
+        glui32 len);
+    glui32 (*get_line)(stream_t *str, char *cbuf, glui32 *ubuf, 
+        glui32 len);
+} gli_stream_ops_t;
+
+/* A file mapped into memory (see OPT_MMAP_FILES). It's shared by the 
+   file stream and any resource streams reading out of it, and unmapped
+   when the last of them is closed. */
+typedef struct gli_mapping_struct {
+    void *base;
+    glui32 len;
+    int refcount;
+} gli_mapping_t;
+
 struct glk_stream_struct {
     glui32 magicnum;
     glui32 rock;
 
     int type; /* file, window, or memory stream */
     int unicode; /* one-byte or four-byte chars? Not meaningful for windows */
+    gli_stream_ops_t *ops; /* how to read and write this kind of stream */
     
     glui32 readcount, writecount;
     int readable, writable;
@@ -89,12 +151,18 @@ struct glk_stream_struct {
     /* for strtype_File */
     FILE *file; 
     glui32 lastop; /* 0, filemode_Write, or filemode_Read */
+    int mapped; /* read-only file mapped into buf, with no FILE */
+    
+    /* for mapped files, and resource streams that read out of a mapped
+       blorb file: the mapping that buf points into. */
+    gli_mapping_t *mapping;
     
-    /* for strtype_Resource */
+    /* for strtype_Resource and strtype_File: binary, not text. (Four-byte
+       binary files are big-endian; four-byte text files are UTF-8.) */
     int isbinary;
 
-    /* for strtype_Memory and strtype_Resource. Separate pointers for 
-       one-byte and four-byte streams */
+    /* for strtype_Memory, strtype_Resource, and mapped files. Separate
+       pointers for one-byte and four-byte streams */
     unsigned char *buf;
     unsigned char *bufptr;
     unsigned char *bufend;
@@ -107,7 +175,8 @@ struct glk_stream_struct {
     gidispatch_rock_t arrayrock;
 
     gidispatch_rock_t disprock;
-    stream_t *next, *prev; /* in the big linked list of streams */
+    glui32 poolindex; /* position in the list of live streams */
+    glui32 poolgen; /* generation of this slot; see gtpool.c */
 };
 
 struct glk_fileref_struct {
@@ -119,9 +188,23 @@ struct glk_fileref_struct {
     int textmode;
 
     gidispatch_rock_t disprock;
-    fileref_t *next, *prev; /* in the big linked list of filerefs */
+    glui32 poolindex; /* position in the list of live filerefs */
+    glui32 poolgen; /* generation of this slot; see gtpool.c */
 };
 
+/* A snapshot of the library state, being built up or read back. See
+    gtsnap.c. */
+typedef struct gli_snapshot_struct {
+    unsigned char *buf;
+    glui32 len; /* bytes written, or bytes available to read */
+    glui32 size; /* bytes allocated, when writing */
+    glui32 pos; /* the read position */
+    int error; /* set by any write that fails or read that overruns */
+} gli_snapshot_t;
+
+/* The index stored for a window reference which is NULL. */
+#define SNAP_NONE (0xFFFFFFFF)
+
 /* Arguments to keybindings */
 
 #define gcmd_Left (1)
@@ -182,6 +265,10 @@ extern void (*gli_unregister_obj)(void *obj, glui32 objclass, gidispatch_rock_t
 extern gidispatch_rock_t (*gli_register_arr)(void *array, glui32 len, char *typecode);
 extern void (*gli_unregister_arr)(void *array, glui32 len, char *typecode, 
     gidispatch_rock_t objrock);
+extern long (*gli_locate_arr)(void *array, glui32 len, char *typecode,
+    gidispatch_rock_t objrock, int *elemsizeref);
+extern gidispatch_rock_t (*gli_restore_arr)(long bufkey, glui32 len,
+    char *typecode, void **arrayref);
 
 extern int pref_printversion;
 extern int pref_screenwidth;
@@ -192,11 +279,20 @@ extern int pref_override_window_borders;
 extern int pref_window_borders;
 extern int pref_precise_timing;
 extern int pref_historylen;
+extern int pref_scrollback;
+extern int pref_layoutcache;
+extern int pref_hardware_scroll;
 extern int pref_prompt_defaults;
+extern int pref_resize_delay;
 
 /* Declarations of library internal functions. */
 
 extern void gli_initialize_misc(void);
+
+extern void *gli_pool_alloc(gli_pool_t *pool);
+extern void gli_pool_release(gli_pool_t *pool, void *obj);
+extern void *gli_pool_next(gli_pool_t *pool, void *obj);
+extern void gli_pool_compact(gli_pool_t *pool);
 extern char *gli_ascii_equivalent(unsigned char ch);
 
 extern void gli_msgline_warning(char *msg);
@@ -220,18 +316,36 @@ extern void gli_fast_exit(void);
 extern window_t *gli_new_window(glui32 type, glui32 rock);
 extern void gli_delete_window(window_t *win);
 extern window_t *gli_window_iterate_treeorder(window_t *win);
+extern void gli_window_input_changed(window_t *win);
+extern window_t *gli_window_next_input(window_t *win);
+extern int gli_window_count_input(void);
 extern void gli_window_rearrange(window_t *win, grect_t *box);
 extern void gli_window_redraw(window_t *win);
 extern void gli_windows_redraw(void);
 extern void gli_windows_update(void);
-extern void gli_windows_size_change(void);
+extern void gli_windows_new_screen(void);
+extern void gli_windows_size_change(int settled);
 extern void gli_windows_place_cursor(void);
+extern void gli_damage_rect(int left, int top, int right, int bottom);
+extern void gli_windows_flush(void);
 extern void gli_windows_set_paging(int forcetoend);
 extern void gli_windows_trim_buffers(void);
 extern void gli_window_put_char(window_t *win, char ch);
+extern void gli_window_put_buffer(window_t *win, char *buf, glui32 len);
 extern void gli_windows_unechostream(stream_t *str);
+extern void gli_windows_restore_tree(window_t *root, window_t *focus);
+extern void gli_windows_compact(void);
 extern void gli_print_spaces(int len);
 
+#ifdef OPT_CURSES_STATS
+extern long gli_curses_calls;
+#define gli_count_curses(num) (gli_curses_calls += (num))
+extern void gli_curses_stats_frame(void);
+extern void gli_curses_stats_report(void);
+#else /* OPT_CURSES_STATS */
+#define gli_count_curses(num) 
+#endif /* OPT_CURSES_STATS */
+
 extern void gcmd_win_change_focus(window_t *win, glui32 arg);
 extern void gcmd_win_refresh(window_t *win, glui32 arg);
 
@@ -247,11 +361,25 @@ extern void gli_stream_fill_result(stream_t *str,
 extern void gli_stream_echo_line(stream_t *str, char *buf, glui32 len);
 extern void gli_stream_echo_line_uni(stream_t *str, glui32 *buf, glui32 len);
 extern void gli_streams_close_all(void);
+extern strid_t gli_get_resource_file(void);
+extern void gli_forget_resource_file(void);
+extern void gli_putchar_utf8(glui32 val, FILE *fl);
 
 extern fileref_t *gli_new_fileref(char *filename, glui32 usage, 
     glui32 rock);
 extern void gli_delete_fileref(fileref_t *fref);
 
+extern void gli_snap_put_int(gli_snapshot_t *snap, glui32 val);
+extern void gli_snap_put_buffer(gli_snapshot_t *snap, void *buf, 
+    glui32 len);
+extern void gli_snap_put_inbuf(gli_snapshot_t *snap, void *buf, 
+    glui32 len, int unicode, gidispatch_rock_t rock);
+extern glui32 gli_snap_get_int(gli_snapshot_t *snap);
+extern void gli_snap_get_buffer(gli_snapshot_t *snap, void *buf, 
+    glui32 len);
+extern void *gli_snap_get_inbuf(gli_snapshot_t *snap, glui32 len, 
+    int unicode, gidispatch_rock_t *rockref);
+
 /* A macro that I can't think of anywhere else to put it. */
 
 #define gli_event_clearevent(evp)  \
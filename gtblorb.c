@@ -1,4 +1,7 @@
+#include "gtoption.h"
+#include <stdio.h>
 #include "glk.h"
+#include "glkterm.h"
 #include "gi_blorb.h"
 
 /* We'd like to be able to deal with game files in Blorb files, even
@@ -6,6 +9,8 @@
    here. */
 
 static giblorb_map_t *blorbmap = 0; /* NULL */
+static strid_t blorbfile = 0; /* NULL */
+static glui32 blorbgen = 0; /* blorbfile's slot generation */
 
 giblorb_err_t giblorb_set_resource_map(strid_t file)
 {
@@ -14,9 +19,12 @@ giblorb_err_t giblorb_set_resource_map(strid_t file)
   err = giblorb_create_map(file, &blorbmap);
   if (err) {
     blorbmap = 0; /* NULL */
+    blorbfile = 0; /* NULL */
     return err;
   }
   
+  blorbfile = file;
+  blorbgen = file->poolgen;
   return giblorb_err_None;
 }
 
@@ -24,3 +32,21 @@ giblorb_map_t *giblorb_get_resource_map()
 {
   return blorbmap;
 }
+
+/* The stream the resource map was read from. Resource streams read 
+   straight out of it if it's a mapped file (see gtstream.c). This is
+   NULL if that stream has been closed, even if its slot has since been
+   reused. */
+strid_t gli_get_resource_file()
+{
+  if (!gli_stream_valid(blorbfile) || blorbfile->poolgen != blorbgen)
+    return 0; /* NULL */
+  return blorbfile;
+}
+
+/* The resource file's stream is being closed. Forget it, so that a new
+   stream which reuses its slot isn't mistaken for it. */
+void gli_forget_resource_file()
+{
+  blorbfile = 0; /* NULL */
+}
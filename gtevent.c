@@ -35,6 +35,22 @@ static glui32 timing_msec; /* The current timed-event request, exactly as
 
 #endif /* OPT_TIMED_INPUT */
 
+#ifdef OPT_USE_SIGNALS
+#ifdef OPT_WINCHANGED_SIGNAL
+
+    /* TRUE if the screen has been resized, but the windows have not yet
+        been rearranged to fit, because the size may still be changing. */
+    static int resize_pending = FALSE;
+#ifdef OPT_TIMED_INPUT
+    /* The time at which the pending resize counts as settled. */
+    static struct timeval resize_time;
+#endif /* OPT_TIMED_INPUT */
+
+    static int gli_check_resize(void);
+
+#endif /* OPT_WINCHANGED_SIGNAL */
+#endif /* OPT_USE_SIGNALS */
+
 /* Set up the input system. This is called from main(). */
 void gli_initialize_events()
 {
@@ -61,8 +77,7 @@ void glk_select(event_t *event)
         /* It would be nice to display a "hit any key to continue" message in
             all windows which require it. */
         if (needrefresh) {
-            gli_windows_place_cursor();
-            refresh();
+            gli_windows_flush();
             needrefresh = FALSE;
         }
         key = getch();
@@ -91,17 +106,15 @@ void glk_select(event_t *event)
         if (just_resumed) {
             just_resumed = FALSE;
             gli_set_halfdelay();
+            gli_damage_rect(0, 0, COLS, LINES);
             needrefresh = TRUE;
             continue;
         }
 
 #ifdef OPT_WINCHANGED_SIGNAL
-        /* Check to see if the screen-size has changed. The 
-            screen_size_changed flag is set by the SIGWINCH signal
-            handler. */
-        if (screen_size_changed) {
-            screen_size_changed = FALSE;
-            gli_windows_size_change();
+        /* Check to see if the screen-size has changed, or has stopped
+            changing. */
+        if (gli_check_resize()) {
             needrefresh = TRUE;
             continue;
         }
@@ -149,22 +162,20 @@ void glk_select_poll(event_t *event)
     while (firsttime) {
         firsttime = FALSE;
 
-        gli_windows_place_cursor();
-        refresh();
+        /* This skips refresh() entirely if nothing has been drawn, which
+            matters for games that poll constantly. */
+        gli_windows_flush();
         
 #ifdef OPT_USE_SIGNALS
 
         /* We don't need to check to see if the program has just resumed. 
             The only reason glk_select() does that is to refresh the screen,
-            and that's just been done anyhow. */
+            and that's just been done anyhow (if it was needed). */
 
 #ifdef OPT_WINCHANGED_SIGNAL
-        /* Check to see if the screen-size has changed. The 
-            screen_size_changed flag is set by the SIGWINCH signal
-            handler. */
-        if (screen_size_changed) {
-            screen_size_changed = FALSE;
-            gli_windows_size_change();
+        /* Check to see if the screen-size has changed, or has stopped
+            changing. */
+        if (gli_check_resize()) {
             continue;
         }
 #endif /* OPT_WINCHANGED_SIGNAL */
@@ -191,6 +202,55 @@ void glk_select_poll(event_t *event)
     curevent = NULL;
 }
 
+#ifdef OPT_USE_SIGNALS
+#ifdef OPT_WINCHANGED_SIGNAL
+
+/* Deal with the screen being resized. The screen_size_changed flag is set
+    by the SIGWINCH signal handler. Dragging a terminal to a new size sends
+    a stream of these signals, and laying out every text buffer for each
+    one would be slow; so each change only redraws the windows as they
+    are, clipped to the new screen, and the real rearrangement (with its
+    Arrange event) waits until the size has stayed the same for 
+    pref_resize_delay milliseconds.
+   Returns TRUE if the screen was redrawn. */
+static int gli_check_resize()
+{
+    if (screen_size_changed) {
+        screen_size_changed = FALSE;
+#ifdef OPT_TIMED_INPUT
+        if (pref_resize_delay > 0) {
+            resize_pending = TRUE;
+            gettimeofday(&resize_time, NULL);
+            add_millisec_to_time(&resize_time, pref_resize_delay);
+        }
+#endif /* OPT_TIMED_INPUT */
+        /* This calls gli_set_halfdelay(), which checks resize_pending. */
+        gli_windows_new_screen();
+        gli_windows_size_change(!resize_pending);
+        return TRUE;
+    }
+    
+    if (resize_pending) {
+#ifdef OPT_TIMED_INPUT
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        if (tv.tv_sec < resize_time.tv_sec
+            || (tv.tv_sec == resize_time.tv_sec &&
+                tv.tv_usec < resize_time.tv_usec))
+            return FALSE;
+#endif /* OPT_TIMED_INPUT */
+        resize_pending = FALSE;
+        gli_set_halfdelay();
+        gli_windows_size_change(TRUE);
+        return TRUE;
+    }
+    
+    return FALSE;
+}
+
+#endif /* OPT_WINCHANGED_SIGNAL */
+#endif /* OPT_USE_SIGNALS */
+
 /* Various modules can call this to indicate that an event has occurred.
     This doesn't try to queue events, but since a single keystroke or
     idle event can only cause one event at most, this is fine. */
@@ -228,7 +288,9 @@ void glk_request_timer_events(glui32 millisecs)
     SIGWINCH signals (which indicate that the window has been resized), it
     has to check for these periodically too. So if OPT_WINCHANGED_SIGNAL
     is defined, we turn on halfdelay() even if the program doesn't want
-    timer events. We use a timeout of half a second in this case. 
+    timer events. We use a timeout of half a second in this case. While
+    a resize is waiting to settle, we drop that to a tenth of a second, so
+    that the windows are rearranged promptly once it has.
 */
     
 void gli_set_halfdelay()
@@ -264,6 +326,10 @@ void gli_set_halfdelay()
         halfdelay_running = TRUE;
         delay = 5; /* half a second */
     }
+#ifdef OPT_WINCHANGED_SIGNAL
+    if (resize_pending && delay > 1)
+        delay = 1;
+#endif /* OPT_WINCHANGED_SIGNAL */
 #endif /* OPT_USE_SIGNALS */
 
     if (halfdelay_running)
@@ -7,6 +7,7 @@
 #include "gtoption.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h> /* for unlink() */
 #include <sys/stat.h> /* for stat() */
@@ -18,8 +19,8 @@
     type.
 */
 
-/* Linked list of all filerefs */
-static fileref_t *gli_filereflist = NULL; 
+/* All filerefs */
+static gli_pool_t filerefpool = GLI_POOL_INIT(fileref_t, poolindex, poolgen);
 
 #define BUFLEN (256)
 
@@ -31,7 +32,7 @@ static char lastdataname[BUFLEN] = "file.glkdata";
 
 fileref_t *gli_new_fileref(char *filename, glui32 usage, glui32 rock)
 {
-    fileref_t *fref = (fileref_t *)malloc(sizeof(fileref_t));
+    fileref_t *fref = (fileref_t *)gli_pool_alloc(&filerefpool);
     if (!fref)
         return NULL;
     
@@ -44,13 +45,6 @@ fileref_t *gli_new_fileref(char *filename, glui32 usage, glui32 rock)
     fref->textmode = ((usage & fileusage_TextMode) != 0);
     fref->filetype = (usage & fileusage_TypeMask);
     
-    fref->prev = NULL;
-    fref->next = gli_filereflist;
-    gli_filereflist = fref;
-    if (fref->next) {
-        fref->next->prev = fref;
-    }
-    
     if (gli_register_obj)
         fref->disprock = (*gli_register_obj)(fref, gidisp_Class_Fileref);
 
@@ -59,8 +53,6 @@ fileref_t *gli_new_fileref(char *filename, glui32 usage, glui32 rock)
 
 void gli_delete_fileref(fileref_t *fref)
 {
-    fileref_t *prev, *next;
-    
     if (gli_unregister_obj)
         (*gli_unregister_obj)(fref, gidisp_Class_Fileref, fref->disprock);
         
@@ -71,24 +63,12 @@ void gli_delete_fileref(fileref_t *fref)
         fref->filename = NULL;
     }
     
-    prev = fref->prev;
-    next = fref->next;
-    fref->prev = NULL;
-    fref->next = NULL;
-
-    if (prev)
-        prev->next = next;
-    else
-        gli_filereflist = next;
-    if (next)
-        next->prev = prev;
-    
-    free(fref);
+    gli_pool_release(&filerefpool, fref);
 }
 
 void glk_fileref_destroy(fileref_t *fref)
 {
-    if (!fref) {
+    if (!gli_fileref_valid(fref)) {
         gli_strict_warning("fileref_destroy: invalid ref");
         return;
     }
@@ -136,7 +116,7 @@ frefid_t glk_fileref_create_from_fileref(glui32 usage, frefid_t oldfref,
 {
     fileref_t *fref; 
 
-    if (!oldfref) {
+    if (!gli_fileref_valid(oldfref)) {
         gli_strict_warning("fileref_create_from_fileref: invalid ref");
         return NULL;
     }
@@ -319,12 +299,7 @@ frefid_t glk_fileref_create_by_prompt(glui32 usage, glui32 fmode,
 
 frefid_t glk_fileref_iterate(fileref_t *fref, glui32 *rock)
 {
-    if (!fref) {
-        fref = gli_filereflist;
-    }
-    else {
-        fref = fref->next;
-    }
+    fref = gli_pool_next(&filerefpool, fref);
     
     if (fref) {
         if (rock)
@@ -339,7 +314,7 @@ frefid_t glk_fileref_iterate(fileref_t *fref, glui32 *rock)
 
 glui32 glk_fileref_get_rock(fileref_t *fref)
 {
-    if (!fref) {
+    if (!gli_fileref_valid(fref)) {
         gli_strict_warning("fileref_get_rock: invalid ref.");
         return 0;
     }
@@ -351,7 +326,7 @@ glui32 glk_fileref_does_file_exist(fileref_t *fref)
 {
     struct stat buf;
     
-    if (!fref) {
+    if (!gli_fileref_valid(fref)) {
         gli_strict_warning("fileref_does_file_exist: invalid ref");
         return FALSE;
     }
@@ -370,7 +345,7 @@ glui32 glk_fileref_does_file_exist(fileref_t *fref)
 
 void glk_fileref_delete_file(fileref_t *fref)
 {
-    if (!fref) {
+    if (!gli_fileref_valid(fref)) {
         gli_strict_warning("fileref_delete_file: invalid ref");
         return;
     }
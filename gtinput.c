@@ -210,7 +210,10 @@ static command_t *commands_textbuffer_char(int key)
     return &cmdv;
 }
 
-/* Keys for line input in a text buffer window. */
+/* Keys for line input in a text buffer window. The scrollback search
+    keys live here rather than above, so that char input still gets 
+    ctrl-R and ctrl-T. (Searching forward isn't on ctrl-S, because most 
+    terminals take that for flow control.) */
 static command_t *commands_textbuffer_line(window_textbuffer_t *dwin, int key)
 {
     static command_t cmdacceptline = { gcmd_buffer_accept_line, 0 };
@@ -226,6 +229,8 @@ static command_t *commands_textbuffer_line(window_textbuffer_t *dwin, int key)
     static command_t cmdkillline = { gcmd_buffer_delete, gcmd_KillLine };
     static command_t cmdhistoryprev = { gcmd_buffer_history, gcmd_Up };
     static command_t cmdhistorynext = { gcmd_buffer_history, gcmd_Down };
+    static command_t cmdsearchback = { gcmd_buffer_search, gcmd_Up };
+    static command_t cmdsearchforward = { gcmd_buffer_search, gcmd_Down };
 
     if (key >= 32 && key < 256 && key != '\177') 
         return &cmdinsert;
@@ -263,6 +268,10 @@ static command_t *commands_textbuffer_line(window_textbuffer_t *dwin, int key)
         case KEY_DOWN:
         case '\016': /* ctrl-N */
             return &cmdhistorynext;
+        case '\022': /* ctrl-R */
+            return &cmdsearchback;
+        case '\024': /* ctrl-T */
+            return &cmdsearchforward;
 
         case '\033': /* escape */
             if (dwin->intermkeys & 0x10000)
@@ -570,18 +579,21 @@ void gli_input_handle_key(int key)
     }
     
     /* If not, see if there's some other window which has a binding for
-        the key; if so, set the focus there. */
+        the key; if so, set the focus there. Only the windows in the input
+        index can have bindings, so those are all we check, in tree order
+        starting after the focus window. */
     if (!cmd && gli_rootwin) {
         window_t *altwin = gli_focuswin;
         command_t *altcmd = NULL;
-        do {
-            altwin = gli_window_iterate_treeorder(altwin);
-            if (altwin && altwin->type != wintype_Pair) {
+        int count;
+        for (count = gli_window_count_input(); count > 0; count--) {
+            altwin = gli_window_next_input(altwin);
+            if (altwin != gli_focuswin) {
                 altcmd = commands_window(altwin, key);
                 if (altcmd)
                     break;
             }
-        } while (altwin != gli_focuswin);
+        }
         if (altwin != gli_focuswin && altcmd) {
             cmd = altcmd;
             win = altwin;
@@ -613,22 +625,21 @@ void gli_input_handle_key(int key)
 void gli_input_guess_focus()
 {
     window_t *altwin;
+    int count;
     
     if (gli_focuswin 
         && (gli_focuswin->line_request || gli_focuswin->char_request)) {
         return;
     }
     
+    /* Every window with a request is in the input index. */
     altwin = gli_focuswin;
-    do {
-        altwin = gli_window_iterate_treeorder(altwin);
-        if (altwin 
-            && (altwin->line_request || altwin->char_request)) {
+    for (count = gli_window_count_input(); count > 0; count--) {
+        altwin = gli_window_next_input(altwin);
+        if (altwin->line_request || altwin->char_request) {
+            gli_focuswin = altwin;
             break;
         }
-    } while (altwin != gli_focuswin);
-    
-    if (gli_focuswin != altwin)
-        gli_focuswin = altwin;
+    }
 }
 
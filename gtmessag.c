@@ -65,6 +65,13 @@ void gli_msgline_redraw()
     if (!pref_messageline)
         return;
         
+    gli_damage_rect(0, content_box.bottom, COLS, content_box.bottom+1);
+    
+    /* While a resize is settling, the old message line may be off the
+        bottom of the screen. */
+    if (content_box.bottom >= LINES)
+        return;
+    
     if (msgbuflen == 0) {
         move(content_box.bottom, 0);
         clrtoeol();
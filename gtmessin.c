@@ -46,6 +46,9 @@ int gli_msgin_getchar(char *prompt, int hilite)
 
     gli_windows_update();
     gli_windows_set_paging(TRUE);
+    /* Get the windows onto the screen; from here on, only stdscr is
+        refreshed. */
+    gli_windows_flush();
     
     if (!prompt)
         prompt = "";
@@ -55,12 +58,18 @@ int gli_msgin_getchar(char *prompt, int hilite)
     /* If the bottom line is reserved for messages, great; clear the message
         line and do input there. If not, we'll have to wipe the bottom line
         of the bottommost game window, and redraw it later. */
-    if (pref_messageline) {
+    if (pref_messageline)
         orgy = content_box.bottom;
+    else
+        orgy = content_box.bottom-1;
+    /* While a resize is settling, content_box may be taller than the
+        screen. */
+    if (orgy > LINES-1)
+        orgy = LINES-1;
+    if (pref_messageline) {
         gli_msgline(NULL);
     }
     else {
-        orgy = content_box.bottom-1;
         move(orgy, 0);
         clrtoeol();
     }
@@ -86,6 +95,7 @@ int gli_msgin_getchar(char *prompt, int hilite)
     else {
         move(orgy, 0);
         clrtoeol();
+        gli_damage_rect(0, orgy, COLS, orgy+1);
         /* We have to redraw everything, unfortunately, to fix the
             last line. */
         gli_windows_update();
@@ -102,6 +112,7 @@ int gli_msgin_getline(char *prompt, char *buf, int maxlen, int *length)
     
     gli_windows_update();
     gli_windows_set_paging(TRUE);
+    gli_windows_flush();
 
     if (!prompt)
         prompt = "";
@@ -118,12 +129,16 @@ int gli_msgin_getline(char *prompt, char *buf, int maxlen, int *length)
     lin->orgx = LEFT_MARGIN + strlen(prompt);
     
     /* See note in gli_msgin_getchar(). */
-    if (pref_messageline) {
+    if (pref_messageline)
         lin->orgy = content_box.bottom;
+    else
+        lin->orgy = content_box.bottom-1;
+    if (lin->orgy > LINES-1)
+        lin->orgy = LINES-1;
+    if (pref_messageline) {
         gli_msgline(NULL);
     }
     else {
-        lin->orgy = content_box.bottom-1;
         move(lin->orgy, 0);
         clrtoeol();
     }
@@ -158,6 +173,7 @@ int gli_msgin_getline(char *prompt, char *buf, int maxlen, int *length)
     else {
         move(lin->orgy, 0);
         clrtoeol();
+        gli_damage_rect(0, lin->orgy, COLS, lin->orgy+1);
         /* We have to redraw everything, unfortunately, to fix the
             last line. */
         gli_windows_update();
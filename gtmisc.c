@@ -28,6 +28,10 @@ void (*gli_unregister_obj)(void *obj, glui32 objclass, gidispatch_rock_t objrock
 gidispatch_rock_t (*gli_register_arr)(void *array, glui32 len, char *typecode) = NULL;
 void (*gli_unregister_arr)(void *array, glui32 len, char *typecode, 
     gidispatch_rock_t objrock) = NULL;
+long (*gli_locate_arr)(void *array, glui32 len, char *typecode,
+    gidispatch_rock_t objrock, int *elemsizeref) = NULL;
+gidispatch_rock_t (*gli_restore_arr)(long bufkey, glui32 len,
+    char *typecode, void **arrayref) = NULL;
 
 static char *char_A0_FF_to_ascii[6*16] = {
     " ", "!", "c", "Lb", NULL, "Y", "|", NULL,
@@ -148,6 +152,9 @@ void glk_exit()
 
     endwin();
     putchar('\n');
+#ifdef OPT_CURSES_STATS
+    gli_curses_stats_report();
+#endif /* OPT_CURSES_STATS */
     exit(0);
 }
 
@@ -225,10 +232,10 @@ void gidispatch_set_autorestore_registry(
     gidispatch_rock_t (*restorearr)(long bufkey, glui32 len,
         char *typecode, void **arrayref))
 {
-    /* GlkTerm is not able to serialize its UI state. Therefore, it
-       does not have the capability of autosaving and autorestoring.
-       Therefore, it will never call these hooks. Therefore, we ignore
-       them and do nothing here. */
+    /* These are used when a pending line input buffer is written into,
+       or read back from, a library state snapshot. See gtsnap.c. */
+    gli_locate_arr = locatearr;
+    gli_restore_arr = restorearr;
 }
 
 unsigned char glk_char_to_lower(unsigned char ch)
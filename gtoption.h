@@ -86,6 +86,48 @@
     memmove() will be defined in gtmisc.c.
 */
 
+#define OPT_SSE2_LAYOUT
+
+/* OPT_SSE2_LAYOUT should be defined if you want text buffer layout to
+    use SSE2 instructions to find word breaks, sixteen characters at a
+    time. This is ignored unless the compiler is generating SSE2 code
+    (it defines __SSE2__, as gcc and clang do on x86-64) and understands
+    GNU C builtins; otherwise the plain character-by-character loop is
+    used. Comment it out if your compiler has trouble with emmintrin.h.
+*/
+
+#define OPT_SSE2_STREAMS
+
+/* OPT_SSE2_STREAMS should be defined if you want Unicode file streams
+    to use SSE2 instructions to convert characters to and from big-endian
+    form, four characters at a time, and to pass runs of ASCII through
+    UTF-8 text files sixteen characters at a time. As with 
+    OPT_SSE2_LAYOUT, this is ignored unless the compiler is generating 
+    SSE2 code and understands GNU C builtins; otherwise the conversion is
+    done a character at a time.
+*/
+
+#define OPT_MMAP_FILES
+
+/* OPT_MMAP_FILES should be defined if your OS has the mmap() call (in
+    sys/mman.h). If this is defined, a file stream opened for reading
+    only is mapped into memory and read directly, rather than through
+    stdio; seeking on it costs nothing. (Empty files, and files that 
+    can't be mapped, fall back to stdio.) Be aware that if another 
+    program truncates a file while it is mapped, reading from it will
+    kill the interpreter with SIGBUS. Comment this out if that worries
+    you, or if your OS has no mmap().
+*/
+
+/* #define OPT_CURSES_STATS */
+
+/* OPT_CURSES_STATS should be defined if you want to know how much work
+    the window drawing code is doing. GlkTerm will count the curses calls
+    made to draw window contents, and when the program exits, print the
+    total, the number of screen updates, and the most calls made in any
+    one update. This is only useful for tuning the display code.
+*/
+
 /* Now comes the character localization problem. Since curses.h is
     available, we glibly assume that 7-bit ASCII is all available --
     all the characters from 0x20 (space) to 0x7E (~). Control
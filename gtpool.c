@@ -0,0 +1,166 @@
+/* gtpool.c: Object pools for windows, streams, and filerefs
+        for GlkTerm, curses.h implementation of the Glk API.
+    Designed by Andrew Plotkin <erkyrath@eblong.com>
+    http://www.eblong.com/zarf/glk/index.html
+*/
+
+#include "gtoption.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "glk.h"
+#include "glkterm.h"
+
+/* Each class of Glk object is carved out of slabs which are never given
+    back to malloc. A Glk handle is just a pointer to the object, so this
+    is what makes it safe to check the magic number of a handle the game
+    has already closed: the memory is still ours, and the magic number
+    was cleared when the object was released.
+   Every slot also has a generation number, which is bumped when the 
+    slot is released. Anything in the library which holds on to a handle
+    across calls can keep the generation with it, and so tell the object
+    it meant from a later one in the same slot.
+   Released slots are reused oldest first, and only once more than a 
+    quarantine's worth of them are waiting. The quarantine is at least
+    POOL_QUARANTINE, and half of all the slots in the pool beyond that;
+    so a game which keeps a lot of objects open, or opens and closes them
+    quickly, gets a proportionally longer wait before a stale handle can
+    alias a new object. (In the steady state the pool holds about twice
+    as many slots as live objects.)
+   The live objects are also kept in an array, in creation order, which
+    is what the iterate functions walk. Each object records its own 
+    position in that array. Releasing an object just leaves a NULL in its
+    place; the array is squeezed up only when the NULLs outnumber the
+    live objects, so a release costs O(1) amortized. */
+
+#define POOL_QUARANTINE (64)
+#define POOL_FIRST_SLAB (16)
+#define POOL_MAX_SLAB (256)
+
+#define pool_index(pool, obj)  \
+    (*(glui32 *)((char *)(obj) + (pool)->indexoffset))
+#define pool_gen(pool, obj)  \
+    (*(glui32 *)((char *)(obj) + (pool)->genoffset))
+
+void *gli_pool_alloc(gli_pool_t *pool)
+{
+    void *obj;
+    glui32 quarantine;
+
+    if (pool->numused >= pool->livesize) {
+        gli_pool_compact(pool);
+    }
+    if (pool->numused >= pool->livesize) {
+        glui32 newsize = (pool->livesize) ? pool->livesize * 2 : 16;
+        void **newlive = (void **)realloc(pool->live,
+            newsize * sizeof(void *));
+        if (!newlive)
+            return NULL;
+        pool->live = newlive;
+        pool->livesize = newsize;
+    }
+
+    quarantine = pool->numslots / 2;
+    if (quarantine < POOL_QUARANTINE)
+        quarantine = POOL_QUARANTINE;
+
+    if (pool->numfree > quarantine) {
+        obj = pool->freeslots[pool->freehead];
+        pool->freehead = (pool->freehead + 1) % pool->freesize;
+        pool->numfree--;
+    }
+    else {
+        if (pool->slabused >= pool->slabobjs) {
+            glui32 newobjs = (pool->slabobjs) ? pool->slabobjs * 2
+                : POOL_FIRST_SLAB;
+            char *slab;
+            if (newobjs > POOL_MAX_SLAB)
+                newobjs = POOL_MAX_SLAB;
+            slab = (char *)malloc(newobjs * pool->objsize);
+            if (!slab)
+                return NULL;
+            /* The old slab is not freed; every slot in it is either live
+                or on the free ring. */
+            pool->slab = slab;
+            pool->slabobjs = newobjs;
+            pool->slabused = 0;
+        }
+        obj = pool->slab + pool->slabused * pool->objsize;
+        pool->slabused++;
+        pool->numslots++;
+        pool_gen(pool, obj) = 0;
+    }
+
+    pool_index(pool, obj) = pool->numused;
+    pool->live[pool->numused] = obj;
+    pool->numused++;
+    pool->numlive++;
+    return obj;
+}
+
+void gli_pool_release(gli_pool_t *pool, void *obj)
+{
+    glui32 jx;
+
+    /* Leave a hole in the live array. An iteration which has already 
+        fetched the next object is not disturbed, even if the array is
+        squeezed up, because that object's position is kept current. */
+    pool->live[pool_index(pool, obj)] = NULL;
+    pool->numlive--;
+    pool_gen(pool, obj)++;
+    if (pool->numused - pool->numlive > pool->numlive
+        && pool->numused - pool->numlive >= POOL_QUARANTINE)
+        gli_pool_compact(pool);
+
+    if (pool->numfree >= pool->freesize) {
+        /* Grow the ring, unwrapping it as we go. */
+        glui32 newsize = (pool->freesize) ? pool->freesize * 2 : 32;
+        void **newfree = (void **)malloc(newsize * sizeof(void *));
+        if (!newfree)
+            return; /* the slot is simply lost */
+        for (jx=0; jx<pool->numfree; jx++)
+            newfree[jx] = pool->freeslots[(pool->freehead + jx) % pool->freesize];
+        if (pool->freeslots)
+            free(pool->freeslots);
+        pool->freeslots = newfree;
+        pool->freesize = newsize;
+        pool->freehead = 0;
+    }
+    pool->freeslots[(pool->freehead + pool->numfree) % pool->freesize] = obj;
+    pool->numfree++;
+}
+
+/* Squeeze the holes out of the live array, keeping the creation order. 
+    Afterwards each live object's position is its place in iteration
+    order. */
+void gli_pool_compact(gli_pool_t *pool)
+{
+    glui32 ix, jx;
+
+    jx = 0;
+    for (ix=0; ix<pool->numused; ix++) {
+        void *obj = pool->live[ix];
+        if (!obj)
+            continue;
+        pool->live[jx] = obj;
+        pool_index(pool, obj) = jx;
+        jx++;
+    }
+    pool->numused = jx;
+}
+
+void *gli_pool_next(gli_pool_t *pool, void *obj)
+{
+    glui32 ix;
+
+    if (!obj)
+        ix = 0;
+    else
+        ix = pool_index(pool, obj) + 1;
+
+    while (ix < pool->numused) {
+        if (pool->live[ix])
+            return pool->live[ix];
+        ix++;
+    }
+    return NULL;
+}
@@ -0,0 +1,522 @@
+/* gtsnap.c: Snapshots of the library state, for autosave and autorestore
+        for GlkTerm, curses.h implementation of the Glk API.
+    Designed by Andrew Plotkin <erkyrath@eblong.com>
+    http://www.eblong.com/zarf/glk/index.html
+*/
+
+#include "gtoption.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curses.h>
+#include "glk.h"
+#include "glkterm.h"
+#include "glkstart.h"
+#include "gtw_pair.h"
+#include "gtw_blnk.h"
+#include "gtw_grid.h"
+#include "gtw_buf.h"
+
+/* An interpreter which suspends a game and resumes it later can save the
+    display with glkunix_save_library_state(), and put it back with
+    glkunix_load_library_state(), instead of replaying the game's output.
+   The snapshot holds the window tree, the contents of every window (text,
+    style runs, and command history for text buffers; cells for text
+    grids), and pending input requests. Streams other than window streams,
+    and filerefs, are not included; the interpreter must reopen those
+    itself.
+   Windows come back in the same glk_window_iterate() order, with the same
+    rocks, so the interpreter can match them up with its own references.
+    A pending line input buffer is found with the autorestore hooks given
+    to gidispatch_set_autorestore_registry(); a window waiting for line
+    input cannot be saved or loaded without them.
+   The format is a sequence of four-byte big-endian values (and raw byte
+    arrays), starting with SNAP_MAGIC and SNAP_VERSION. A snapshot is
+    built in memory and written in one call. It's read back in one call
+    too, or parsed in place if the stream is a mapped file, so loading it
+    costs at most one read and one pass over the buffer. */
+
+#define SNAP_MAGIC (0x47545331) /* 'GTS1' */
+#define SNAP_VERSION (1)
+
+static glui32 snap_index(window_t *win);
+static window_t *snap_window(gli_snapshot_t *snap, window_t **wins,
+    glui32 count);
+static int snap_check_tree(window_t **wins, glui32 count, window_t *root);
+static void snap_discard(window_t **wins, glui32 count);
+
+/* Save the state of all windows to a stream, which should be a binary
+    file or memory stream opened for writing. Returns TRUE on success. */
+glui32 glkunix_save_library_state(strid_t str)
+{
+    gli_snapshot_t snap;
+    window_t *win;
+    window_pair_t *dwin;
+    stream_t *cur;
+    glui32 count;
+
+    if (!gli_stream_valid(str)) {
+        gli_strict_warning("save_library_state: invalid ref");
+        return FALSE;
+    }
+
+    snap.buf = NULL;
+    snap.len = 0;
+    snap.size = 0;
+    snap.pos = 0;
+    snap.error = FALSE;
+
+    gli_snap_put_int(&snap, SNAP_MAGIC);
+    gli_snap_put_int(&snap, SNAP_VERSION);
+
+    /* Window references are written as poolindex values, which have to
+        match iteration order. */
+    gli_windows_compact();
+    count = 0;
+    for (win=glk_window_iterate(NULL, NULL); win;
+        win=glk_window_iterate(win, NULL))
+        count++;
+    gli_snap_put_int(&snap, count);
+
+    /* Every window is created before any of them is filled in, so the
+        types and rocks come first. */
+    for (win=glk_window_iterate(NULL, NULL); win;
+        win=glk_window_iterate(win, NULL)) {
+        gli_snap_put_int(&snap, win->type);
+        gli_snap_put_int(&snap, win->rock);
+    }
+
+    cur = glk_stream_get_current();
+    gli_snap_put_int(&snap, snap_index(gli_rootwin));
+    gli_snap_put_int(&snap, snap_index(gli_focuswin));
+    if (cur && cur->type == strtype_Window)
+        gli_snap_put_int(&snap, snap_index(cur->win));
+    else
+        gli_snap_put_int(&snap, SNAP_NONE);
+
+    for (win=glk_window_iterate(NULL, NULL); win;
+        win=glk_window_iterate(win, NULL)) {
+        gli_snap_put_int(&snap, snap_index(win->parent));
+        gli_snap_put_int(&snap, win->style);
+        gli_snap_put_int(&snap, win->echo_line_input);
+        gli_snap_put_int(&snap, win->terminate_line_input);
+        gli_snap_put_int(&snap, win->line_request);
+        gli_snap_put_int(&snap, win->line_request_uni);
+        gli_snap_put_int(&snap, win->char_request);
+        gli_snap_put_int(&snap, win->char_request_uni);
+        if (win->echostr && win->echostr->type == strtype_Window)
+            gli_snap_put_int(&snap, snap_index(win->echostr->win));
+        else
+            gli_snap_put_int(&snap, SNAP_NONE);
+
+        switch (win->type) {
+            case wintype_Pair:
+                dwin = win->data;
+                gli_snap_put_int(&snap, snap_index(dwin->child1));
+                gli_snap_put_int(&snap, snap_index(dwin->child2));
+                gli_snap_put_int(&snap, snap_index(dwin->key));
+                gli_snap_put_int(&snap, dwin->dir);
+                gli_snap_put_int(&snap, dwin->division);
+                gli_snap_put_int(&snap, dwin->hasborder);
+                gli_snap_put_int(&snap, dwin->size);
+                break;
+            case wintype_TextBuffer:
+                win_textbuffer_save(win, &snap);
+                break;
+            case wintype_TextGrid:
+                win_textgrid_save(win, &snap);
+                break;
+        }
+    }
+
+    if (!snap.error)
+        glk_put_buffer_stream(str, (char *)snap.buf, snap.len);
+
+    if (snap.buf)
+        free(snap.buf);
+    return !snap.error;
+}
+
+/* Read back a snapshot written by glkunix_save_library_state(), from the
+    current position of the stream to its end. This must be called before
+    any window is opened. Returns TRUE on success; on failure, no windows
+    are left open. */
+glui32 glkunix_load_library_state(strid_t str)
+{
+    gli_snapshot_t snap;
+    window_t **wins;
+    window_t *win, *root, *focus, *cur, *echo;
+    window_pair_t *dwin;
+    glui32 count, ix, type, start, len;
+    unsigned char *copy = NULL;
+
+    if (!gli_stream_valid(str)) {
+        gli_strict_warning("load_library_state: invalid ref");
+        return FALSE;
+    }
+    if (glk_window_iterate(NULL, NULL)) {
+        gli_strict_warning("load_library_state: windows are already open");
+        return FALSE;
+    }
+
+    start = glk_stream_get_position(str);
+    glk_stream_set_position(str, 0, seekmode_End);
+    len = glk_stream_get_position(str);
+    glk_stream_set_position(str, start, seekmode_Start);
+    if (len <= start)
+        return FALSE;
+    len -= start;
+
+    if (str->mapped && !str->unicode) {
+        /* The file is already in memory; parse it where it lies, and 
+            leave the stream at its end as a read would. */
+        snap.buf = str->bufptr;
+        snap.len = len;
+        str->bufptr += len;
+        str->readcount += len;
+    }
+    else {
+        copy = (unsigned char *)malloc(len);
+        if (!copy)
+            return FALSE;
+        snap.buf = copy;
+        snap.len = glk_get_buffer_stream(str, (char *)copy, len);
+    }
+    snap.size = len;
+    snap.pos = 0;
+    snap.error = FALSE;
+
+    if (gli_snap_get_int(&snap) != SNAP_MAGIC
+        || gli_snap_get_int(&snap) != SNAP_VERSION) {
+        free(copy);
+        return FALSE;
+    }
+
+    /* Each window takes at least eight bytes, which bounds the count
+        before we allocate anything for it. */
+    count = gli_snap_get_int(&snap);
+    if (snap.error || count > (snap.len - snap.pos) / 8) {
+        free(copy);
+        return FALSE;
+    }
+    if (count == 0) {
+        /* The game had no windows open. */
+        free(copy);
+        return TRUE;
+    }
+    wins = (window_t **)malloc(count * sizeof(window_t *));
+    if (!wins) {
+        free(copy);
+        return FALSE;
+    }
+
+    for (ix=0; ix<count; ix++) {
+        type = gli_snap_get_int(&snap);
+        win = NULL;
+        if (type == wintype_Pair || type == wintype_Blank
+            || type == wintype_TextBuffer || type == wintype_TextGrid)
+            win = gli_new_window(type, gli_snap_get_int(&snap));
+        if (!win) {
+            snap_discard(wins, ix);
+            free(wins);
+            free(copy);
+            return FALSE;
+        }
+        wins[ix] = win;
+        switch (type) {
+            case wintype_Pair:
+                win->data = win_pair_create(win, 0, NULL, 0);
+                break;
+            case wintype_Blank:
+                win->data = win_blank_create(win);
+                break;
+            case wintype_TextBuffer:
+                win->data = win_textbuffer_create(win);
+                break;
+            case wintype_TextGrid:
+                win->data = win_textgrid_create(win);
+                break;
+        }
+        if (!win->data) {
+            gli_delete_window(win);
+            snap_discard(wins, ix);
+            free(wins);
+            free(copy);
+            return FALSE;
+        }
+    }
+
+    root = snap_window(&snap, wins, count);
+    focus = snap_window(&snap, wins, count);
+    cur = snap_window(&snap, wins, count);
+
+    for (ix=0; ix<count && !snap.error; ix++) {
+        win = wins[ix];
+        win->parent = snap_window(&snap, wins, count);
+        win->style = gli_snap_get_int(&snap);
+        if (win->style >= style_NUMSTYLES)
+            win->style = style_Normal;
+        win->echo_line_input = (gli_snap_get_int(&snap) != 0);
+        win->terminate_line_input = gli_snap_get_int(&snap);
+        win->line_request = (gli_snap_get_int(&snap) != 0);
+        win->line_request_uni = (gli_snap_get_int(&snap) != 0);
+        win->char_request = (gli_snap_get_int(&snap) != 0);
+        win->char_request_uni = (gli_snap_get_int(&snap) != 0);
+        echo = snap_window(&snap, wins, count);
+        win->echostr = (echo) ? echo->str : NULL;
+        if (win->type == wintype_Pair || win->type == wintype_Blank) {
+            /* These accept no input. */
+            win->line_request = FALSE;
+            win->line_request_uni = FALSE;
+            win->char_request = FALSE;
+            win->char_request_uni = FALSE;
+        }
+
+        switch (win->type) {
+            case wintype_Pair:
+                dwin = win->data;
+                dwin->child1 = snap_window(&snap, wins, count);
+                dwin->child2 = snap_window(&snap, wins, count);
+                dwin->key = snap_window(&snap, wins, count);
+                dwin->dir = gli_snap_get_int(&snap);
+                dwin->division = gli_snap_get_int(&snap);
+                dwin->hasborder = (gli_snap_get_int(&snap) != 0);
+                dwin->size = gli_snap_get_int(&snap);
+                dwin->vertical = (dwin->dir == winmethod_Left
+                    || dwin->dir == winmethod_Right);
+                dwin->backward = (dwin->dir == winmethod_Left
+                    || dwin->dir == winmethod_Above);
+                break;
+            case wintype_TextBuffer:
+                win_textbuffer_load(win, &snap);
+                break;
+            case wintype_TextGrid:
+                win_textgrid_load(win, &snap);
+                break;
+        }
+    }
+
+    free(copy);
+
+    if (snap.error || !snap_check_tree(wins, count, root)) {
+        snap_discard(wins, count);
+        free(wins);
+        return FALSE;
+    }
+    free(wins);
+
+    if (focus && focus->type == wintype_Pair)
+        focus = NULL;
+    gli_windows_restore_tree(root, focus);
+    if (cur)
+        glk_stream_set_current(cur->str);
+    return TRUE;
+}
+
+/* The index of a window in the snapshot, which is its position in
+    glk_window_iterate() order. (The pool was compacted before saving.) */
+static glui32 snap_index(window_t *win)
+{
+    if (!win)
+        return SNAP_NONE;
+    return win->poolindex;
+}
+
+/* Read a window index, and look it up. An index out of range is an
+    error. */
+static window_t *snap_window(gli_snapshot_t *snap, window_t **wins,
+    glui32 count)
+{
+    glui32 val = gli_snap_get_int(snap);
+    
+    if (val == SNAP_NONE)
+        return NULL;
+    if (val >= count) {
+        snap->error = TRUE;
+        return NULL;
+    }
+    return wins[val];
+}
+
+/* Make sure that the windows read back form a proper tree under root:
+    every pair has two distinct children which name it as their parent,
+    every other window has a parent which names it as a child, and every
+    window leads up to the root. A pair's key, if any, must be a non-pair
+    window below it. */
+static int snap_check_tree(window_t **wins, glui32 count, window_t *root)
+{
+    window_t *win, *wx;
+    window_pair_t *dwin, *dparent;
+    glui32 ix, steps;
+
+    if (!root || root->parent)
+        return FALSE;
+
+    for (ix=0; ix<count; ix++) {
+        win = wins[ix];
+        if (win->type == wintype_Pair) {
+            dwin = win->data;
+            if (!dwin->child1 || !dwin->child2 
+                || dwin->child1 == dwin->child2
+                || dwin->child1->parent != win 
+                || dwin->child2->parent != win)
+                return FALSE;
+            if (dwin->key) {
+                if (dwin->key->type == wintype_Pair)
+                    return FALSE;
+                for (wx=dwin->key->parent, steps=0; wx && wx != win 
+                    && steps < count; wx=wx->parent, steps++) { }
+                if (wx != win)
+                    return FALSE;
+            }
+        }
+        if (win->parent) {
+            if (win->parent->type != wintype_Pair)
+                return FALSE;
+            dparent = win->parent->data;
+            if (dparent->child1 != win && dparent->child2 != win)
+                return FALSE;
+        }
+        else if (win != root) {
+            return FALSE;
+        }
+        for (wx=win, steps=0; wx->parent && steps < count; 
+            wx=wx->parent, steps++) { }
+        if (wx != root)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Throw away windows which were read back from a bad snapshot. The tree
+    can't be trusted, so each one is destroyed on its own. */
+static void snap_discard(window_t **wins, glui32 count)
+{
+    window_t *win;
+    glui32 ix;
+
+    for (ix=0; ix<count; ix++) {
+        win = wins[ix];
+        switch (win->type) {
+            case wintype_Pair:
+                win_pair_destroy(win->data);
+                break;
+            case wintype_Blank:
+                win_blank_destroy(win->data);
+                break;
+            case wintype_TextBuffer:
+                win_textbuffer_destroy(win->data);
+                break;
+            case wintype_TextGrid:
+                win_textgrid_destroy(win->data);
+                break;
+        }
+        win->data = NULL;
+        gli_delete_window(win);
+    }
+}
+
+/* Append a four-byte value to the snapshot, growing the buffer as 
+    necessary. */
+void gli_snap_put_int(gli_snapshot_t *snap, glui32 val)
+{
+    unsigned char buf[4];
+
+    buf[0] = (val >> 24) & 0xFF;
+    buf[1] = (val >> 16) & 0xFF;
+    buf[2] = (val >> 8) & 0xFF;
+    buf[3] = (val) & 0xFF;
+    gli_snap_put_buffer(snap, buf, 4);
+}
+
+void gli_snap_put_buffer(gli_snapshot_t *snap, void *buf, glui32 len)
+{
+    unsigned char *newbuf;
+    glui32 newsize;
+
+    if (snap->error)
+        return;
+
+    if (snap->len + len > snap->size) {
+        newsize = (snap->size) ? snap->size * 2 : 4096;
+        while (newsize < snap->len + len)
+            newsize *= 2;
+        newbuf = (unsigned char *)realloc(snap->buf, newsize);
+        if (!newbuf) {
+            snap->error = TRUE;
+            return;
+        }
+        snap->buf = newbuf;
+        snap->size = newsize;
+    }
+
+    memcpy(snap->buf + snap->len, buf, len);
+    snap->len += len;
+}
+
+/* Append a reference to a line input buffer, as the key which the
+    interpreter's locate hook returns for it. */
+void gli_snap_put_inbuf(gli_snapshot_t *snap, void *buf, glui32 len,
+    int unicode, gidispatch_rock_t rock)
+{
+    char *typedesc = (unicode ? "&+#!Iu" : "&+#!Cn");
+    int elemsize;
+
+    if (!gli_locate_arr) {
+        snap->error = TRUE;
+        return;
+    }
+    gli_snap_put_int(snap, 
+        (glui32)(*gli_locate_arr)(buf, len, typedesc, rock, &elemsize));
+}
+
+/* Read a four-byte value. Reading past the end returns zero, and marks the
+    snapshot as bad. */
+glui32 gli_snap_get_int(gli_snapshot_t *snap)
+{
+    unsigned char *cx;
+
+    if (snap->error || snap->len - snap->pos < 4) {
+        snap->error = TRUE;
+        return 0;
+    }
+
+    cx = snap->buf + snap->pos;
+    snap->pos += 4;
+    return ((glui32)cx[0] << 24) | ((glui32)cx[1] << 16) 
+        | ((glui32)cx[2] << 8) | (glui32)cx[3];
+}
+
+void gli_snap_get_buffer(gli_snapshot_t *snap, void *buf, glui32 len)
+{
+    if (snap->error || snap->len - snap->pos < len) {
+        snap->error = TRUE;
+        return;
+    }
+
+    memcpy(buf, snap->buf + snap->pos, len);
+    snap->pos += len;
+}
+
+/* Read a line input buffer reference, and get the buffer back from the
+    interpreter's restore hook. */
+void *gli_snap_get_inbuf(gli_snapshot_t *snap, glui32 len, int unicode,
+    gidispatch_rock_t *rockref)
+{
+    char *typedesc = (unicode ? "&+#!Iu" : "&+#!Cn");
+    void *buf;
+    long bufkey;
+
+    bufkey = (long)gli_snap_get_int(snap);
+    if (snap->error || !gli_restore_arr) {
+        snap->error = TRUE;
+        return NULL;
+    }
+
+    buf = NULL;
+    *rockref = (*gli_restore_arr)(bufkey, len, typedesc, &buf);
+    if (!buf)
+        snap->error = TRUE;
+    return buf;
+}
@@ -7,11 +7,25 @@
 #include "gtoption.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "glk.h"
 #include "glkterm.h"
 #include "gi_blorb.h"
 
+#ifdef OPT_MMAP_FILES
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* OPT_MMAP_FILES */
+
+#if defined(OPT_SSE2_STREAMS) && defined(__SSE2__) && defined(__GNUC__)
+#define USE_SSE2_STREAMS
+#include <emmintrin.h>
+#endif /* OPT_SSE2_STREAMS */
+
 /* This implements pretty much what any Glk implementation needs for 
     stream stuff. Memory streams, file streams (using stdio functions), 
     and window streams (which print through window functions in other
@@ -21,13 +35,26 @@
     functions.) 
 */
 
-static stream_t *gli_streamlist = NULL; /* linked list of all streams */
+/* Buffers of characters are written to (and read from) files through a
+    block on the stack of this many characters. */
+#define STREAM_BLOCK_CHARS (1024)
+
+static gli_pool_t streampool = GLI_POOL_INIT(stream_t, poolindex, poolgen);
 static stream_t *gli_currentstr = NULL; /* the current output stream */
 
+/* The operation tables for each kind of stream; these are filled in 
+    further down, next to the functions they point at. */
+static gli_stream_ops_t memory8_ops, memory32_ops, file8_ops, file32_ops,
+    fileutf8_ops, resource_ops, window_ops;
+
+static void gli_put_char(stream_t *str, glui32 ch);
+static void gli_put_buffer(stream_t *str, char *buf, glui32 len);
+static void gli_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len);
+
 stream_t *gli_new_stream(int type, int readable, int writable, 
     glui32 rock)
 {
-    stream_t *str = (stream_t *)malloc(sizeof(stream_t));
+    stream_t *str = (stream_t *)gli_pool_alloc(&streampool);
     if (!str)
         return NULL;
     
@@ -37,10 +64,28 @@ stream_t *gli_new_stream(int type, int readable, int writable,
 
     str->unicode = FALSE;
     str->isbinary = FALSE;
+
+    /* The one-byte table for this type. The unicode openers replace 
+        this with the four-byte table. */
+    switch (type) {
+        case strtype_File:
+            str->ops = &file8_ops;
+            break;
+        case strtype_Window:
+            str->ops = &window_ops;
+            break;
+        case strtype_Memory:
+        case strtype_Resource:
+        default:
+            str->ops = &memory8_ops;
+            break;
+    }
     
     str->win = NULL;
     str->file = NULL;
     str->lastop = 0;
+    str->mapped = FALSE;
+    str->mapping = NULL;
     str->buf = NULL;
     str->bufptr = NULL;
     str->bufend = NULL;
@@ -56,13 +101,6 @@ stream_t *gli_new_stream(int type, int readable, int writable,
     str->readable = readable;
     str->writable = writable;
     
-    str->prev = NULL;
-    str->next = gli_streamlist;
-    gli_streamlist = str;
-    if (str->next) {
-        str->next->prev = str;
-    }
-    
     if (gli_register_obj)
         str->disprock = (*gli_register_obj)(str, gidisp_Class_Stream);
     else
@@ -71,13 +109,27 @@ stream_t *gli_new_stream(int type, int readable, int writable,
     return str;
 }
 
+/* Drop one reference to a mapped file, and unmap it if that was the 
+    last. */
+static void gli_release_mapping(gli_mapping_t *mapping)
+{
+    mapping->refcount--;
+    if (mapping->refcount > 0)
+        return;
+#ifdef OPT_MMAP_FILES
+    munmap(mapping->base, mapping->len);
+#endif /* OPT_MMAP_FILES */
+    free(mapping);
+}
+
 void gli_delete_stream(stream_t *str)
 {
-    stream_t *prev, *next;
-    
     if (str == gli_currentstr) {
         gli_currentstr = NULL;
     }
+    if (str == gli_get_resource_file()) {
+        gli_forget_resource_file();
+    }
     
     gli_windows_unechostream(str);
     
@@ -97,9 +149,22 @@ void gli_delete_stream(stream_t *str)
             }
             break;
         case strtype_Resource: 
-            /* nothing necessary; the array belongs to gi_blorb.c. */
+            /* The array belongs to gi_blorb.c, or else to the mapped
+                blorb file, which we may have been keeping alive. */
+            if (str->mapping) {
+                gli_release_mapping(str->mapping);
+                str->mapping = NULL;
+            }
             break;
         case strtype_File:
+            if (str->mapped) {
+                /* Resource streams may still be reading out of this. */
+                gli_release_mapping(str->mapping);
+                str->mapping = NULL;
+                str->buf = NULL;
+                str->mapped = FALSE;
+                break;
+            }
             /* close the FILE */
             fclose(str->file);
             str->file = NULL;
@@ -112,19 +177,7 @@ void gli_delete_stream(stream_t *str)
         str->disprock.ptr = NULL;
     }
 
-    prev = str->prev;
-    next = str->next;
-    str->prev = NULL;
-    str->next = NULL;
-
-    if (prev)
-        prev->next = next;
-    else
-        gli_streamlist = next;
-    if (next)
-        next->prev = prev;
-
-    free(str);
+    gli_pool_release(&streampool, str);
 }
 
 void gli_stream_fill_result(stream_t *str, stream_result_t *result)
@@ -138,7 +191,7 @@ void gli_stream_fill_result(stream_t *str, stream_result_t *result)
 
 void glk_stream_close(stream_t *str, stream_result_t *result)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("stream_close: invalid ref.");
         return;
     }
@@ -158,9 +211,9 @@ void gli_streams_close_all()
         only ones that need finalization.) */
     stream_t *str, *strnext;
     
-    str=gli_streamlist;
+    str = gli_pool_next(&streampool, NULL);
     while (str) {
-        strnext = str->next;
+        strnext = gli_pool_next(&streampool, str);
         
         if (str->type == strtype_File) {
             gli_delete_stream(str);
@@ -221,6 +274,64 @@ stream_t *gli_stream_open_window(window_t *win)
     return str;
 }
 
+#ifdef OPT_MMAP_FILES
+
+/* Open a read-only file stream by mapping the whole file into memory.
+    The stream reads it with the memory-stream functions, and there's no
+    FILE at all. This returns NULL if the file can't be mapped (or is
+    empty, which mmap() doesn't allow); the caller should go on to open
+    it with stdio, which will report any real error. */
+static stream_t *gli_stream_open_mapped(char *pathname, glui32 rock)
+{
+    stream_t *str;
+    gli_mapping_t *mapping;
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    fd = open(pathname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || st.st_size <= 0 || st.st_size > 0x7FFFFFFF) {
+        close(fd);
+        return NULL;
+    }
+    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* The mapping stays good after the descriptor is closed. */
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    mapping = (gli_mapping_t *)malloc(sizeof(gli_mapping_t));
+    if (!mapping) {
+        munmap(ptr, st.st_size);
+        return NULL;
+    }
+    mapping->base = ptr;
+    mapping->len = st.st_size;
+    mapping->refcount = 1;
+
+    str = gli_new_stream(strtype_File, TRUE, FALSE, rock);
+    if (!str) {
+        gli_release_mapping(mapping);
+        return NULL;
+    }
+
+    str->mapped = TRUE;
+    str->mapping = mapping;
+    str->ops = &memory8_ops;
+    str->buf = (unsigned char *)ptr;
+    str->bufptr = str->buf;
+    str->buflen = st.st_size;
+    str->bufend = str->buf + str->buflen;
+    str->bufeof = str->bufend;
+
+    return str;
+}
+
+#endif /* OPT_MMAP_FILES */
+
 strid_t glk_stream_open_file(fileref_t *fref, glui32 fmode,
     glui32 rock)
 {
@@ -244,6 +355,16 @@ strid_t glk_stream_open_file(fileref_t *fref, glui32 fmode,
        track the most recent operation (as lastop) -- Write, Read, or
        0 if either is legal next. */
 
+#ifdef OPT_MMAP_FILES
+    if (fmode == filemode_Read) {
+        str = gli_stream_open_mapped(fref->filename, rock);
+        if (str) {
+            str->isbinary = !fref->textmode;
+            return str;
+        }
+    }
+#endif /* OPT_MMAP_FILES */
+
     if (fmode == filemode_ReadWrite || fmode == filemode_WriteAppend) {
         fl = fopen(fref->filename, "ab");
         if (!fl) {
@@ -296,6 +417,7 @@ strid_t glk_stream_open_file(fileref_t *fref, glui32 fmode,
     
     str->file = fl;
     str->lastop = 0;
+    str->isbinary = !fref->textmode;
     
     return str;
 }
@@ -324,6 +446,7 @@ strid_t glk_stream_open_memory_uni(glui32 *ubuf, glui32 buflen, glui32 fmode,
     }
     
     str->unicode = TRUE;
+    str->ops = &memory32_ops;
 
     if (ubuf && buflen) {
         str->ubuf = ubuf;
@@ -346,8 +469,19 @@ strid_t glk_stream_open_file_uni(fileref_t *fref, glui32 fmode,
     glui32 rock)
 {
     strid_t str = glk_stream_open_file(fref, fmode, rock);
+    if (!str)
+        return NULL;
     /* Unlovely, but it works in this library */
     str->unicode = TRUE;
+    /* Binary files hold big-endian four-byte characters; text files
+        hold UTF-8. A mapped file is read exactly like a resource of
+        the same sort. */
+    if (str->mapped)
+        str->ops = &resource_ops;
+    else if (str->isbinary)
+        str->ops = &file32_ops;
+    else
+        str->ops = &fileutf8_ops;
     return str;
 }
 
@@ -356,37 +490,67 @@ strid_t glk_stream_open_file_uni(fileref_t *fref, glui32 fmode,
 
 #ifdef GLK_MODULE_RESOURCE_STREAM
 
-strid_t glk_stream_open_resource(glui32 filenum, glui32 rock)
+/* Find the data chunk for a resource stream, and whether it's text or
+    binary. If the blorb file was opened as a mapped stream (see 
+    OPT_MMAP_FILES), we just point into the mapping; nothing is allocated
+    or read, and only the pages the game reads are ever touched. 
+    Otherwise we have gi_blorb.c load the chunk into memory. It's 
+    important to not call chunk_unload() until the stream is closed (and
+    we won't), so that copy sticks around. In the mapped case, 
+    *mappingref is set to the mapping, which the caller must hold a 
+    reference to for as long as it reads from it; otherwise it's NULL.
+    Returns FALSE if there's no such resource. */
+static int gli_locate_resource(glui32 filenum, unsigned char **dataref,
+    glui32 *lengthref, int *isbinaryref, gli_mapping_t **mappingref)
 {
-    strid_t str;
-    int isbinary;
     giblorb_err_t err;
     giblorb_result_t res;
     giblorb_map_t *map = giblorb_get_resource_map();
+    stream_t *file = gli_get_resource_file();
+    int mapped;
     if (!map)
-        return 0; /* Not running from a blorb file */
+        return FALSE; /* Not running from a blorb file */
 
-    err = giblorb_load_resource(map, giblorb_method_Memory, &res, giblorb_ID_Data, filenum);
+    mapped = (gli_stream_valid(file) && file->mapped);
+    err = giblorb_load_resource(map, 
+        (mapped ? giblorb_method_FilePos : giblorb_method_Memory), 
+        &res, giblorb_ID_Data, filenum);
     if (err)
-        return 0; /* Not found, or some other error */
-
-    /* We'll use the in-memory copy of the chunk data as the basis for
-       our new stream. It's important to not call chunk_unload() until
-       the stream is closed (and we won't). 
-
-       This will be memory-hoggish for giant data chunks, but I don't
-       expect giant data chunks at this point. A more efficient model
-       would be to use the file on disk, but this requires some hacking
-       into the file stream code (we'd need to open a new FILE*) and
-       I don't feel like doing that. */
+        return FALSE; /* Not found, or some other error */
 
     if (res.chunktype == giblorb_ID_TEXT)
-        isbinary = FALSE;
+        *isbinaryref = FALSE;
     else if (res.chunktype == giblorb_ID_BINA
         || res.chunktype == giblorb_make_id('F', 'O', 'R', 'M'))
-        isbinary = TRUE;
+        *isbinaryref = TRUE;
     else
-        return 0; /* Unknown chunk type */
+        return FALSE; /* Unknown chunk type */
+
+    if (mapped) {
+        if (res.data.startpos > file->buflen
+            || res.length > file->buflen - res.data.startpos)
+            return FALSE; /* The chunk runs off the end of the file */
+        *dataref = file->buf + res.data.startpos;
+        *mappingref = file->mapping;
+    }
+    else {
+        *dataref = (unsigned char *)res.data.ptr;
+        *mappingref = NULL;
+    }
+    *lengthref = res.length;
+    return TRUE;
+}
+
+strid_t glk_stream_open_resource(glui32 filenum, glui32 rock)
+{
+    strid_t str;
+    int isbinary;
+    unsigned char *data;
+    glui32 length;
+    gli_mapping_t *mapping;
+
+    if (!gli_locate_resource(filenum, &data, &length, &isbinary, &mapping))
+        return 0;
 
     str = gli_new_stream(strtype_Resource,
         TRUE, FALSE, rock);
@@ -397,10 +561,17 @@ strid_t glk_stream_open_resource(glui32 filenum, glui32 rock)
 
     str->isbinary = isbinary;
     
-    if (res.data.ptr && res.length) {
-        str->buf = (unsigned char *)res.data.ptr;
-        str->bufptr = (unsigned char *)res.data.ptr;
-        str->buflen = res.length;
+    if (mapping) {
+        /* Keep the blorb file's mapping alive, even if it's closed
+            before this stream is. */
+        mapping->refcount++;
+        str->mapping = mapping;
+    }
+    
+    if (data && length) {
+        str->buf = data;
+        str->bufptr = data;
+        str->buflen = length;
         str->bufend = str->buf + str->buflen;
         str->bufeof = str->bufend;
     }
@@ -412,23 +583,12 @@ strid_t glk_stream_open_resource_uni(glui32 filenum, glui32 rock)
 {
     strid_t str;
     int isbinary;
-    giblorb_err_t err;
-    giblorb_result_t res;
-    giblorb_map_t *map = giblorb_get_resource_map();
-    if (!map)
-        return 0; /* Not running from a blorb file */
-
-    err = giblorb_load_resource(map, giblorb_method_Memory, &res, giblorb_ID_Data, filenum);
-    if (err)
-        return 0; /* Not found, or some other error */
+    unsigned char *data;
+    glui32 length;
+    gli_mapping_t *mapping;
 
-    if (res.chunktype == giblorb_ID_TEXT)
-        isbinary = FALSE;
-    else if (res.chunktype == giblorb_ID_BINA
-        || res.chunktype == giblorb_make_id('F', 'O', 'R', 'M'))
-        isbinary = TRUE;
-    else
-        return 0; /* Unknown chunk type */
+    if (!gli_locate_resource(filenum, &data, &length, &isbinary, &mapping))
+        return 0;
 
     str = gli_new_stream(strtype_Resource, 
         TRUE, FALSE, rock);
@@ -439,6 +599,7 @@ strid_t glk_stream_open_resource_uni(glui32 filenum, glui32 rock)
     
     str->unicode = TRUE;
     str->isbinary = isbinary;
+    str->ops = &resource_ops;
 
     /* We have been handed an array of bytes. (They're big-endian
        four-byte chunks, or perhaps a UTF-8 byte sequence, rather than
@@ -446,10 +607,17 @@ strid_t glk_stream_open_resource_uni(glui32 filenum, glui32 rock)
        rather than ubuf -- we'll have to do the translation in the
        get() functions. */
 
-    if (res.data.ptr && res.length) {
-        str->buf = (unsigned char *)res.data.ptr;
-        str->bufptr = (unsigned char *)res.data.ptr;
-        str->buflen = res.length;
+    if (mapping) {
+        /* Keep the blorb file's mapping alive, even if it's closed
+            before this stream is. */
+        mapping->refcount++;
+        str->mapping = mapping;
+    }
+    
+    if (data && length) {
+        str->buf = data;
+        str->bufptr = data;
+        str->buflen = length;
         str->bufend = str->buf + str->buflen;
         str->bufeof = str->bufend;
     }
@@ -466,6 +634,16 @@ strid_t gli_stream_open_pathname(char *pathname, int writemode,
     stream_t *str;
     FILE *fl;
     
+#ifdef OPT_MMAP_FILES
+    if (!writemode) {
+        str = gli_stream_open_mapped(pathname, rock);
+        if (str) {
+            str->isbinary = !textmode;
+            return str;
+        }
+    }
+#endif /* OPT_MMAP_FILES */
+
     if (!writemode)
         strcpy(modestr, "r");
     else
@@ -487,18 +665,14 @@ strid_t gli_stream_open_pathname(char *pathname, int writemode,
     
     str->file = fl;
     str->lastop = 0;
+    str->isbinary = !textmode;
     
     return str;
 }
 
 strid_t glk_stream_iterate(strid_t str, glui32 *rock)
 {
-    if (!str) {
-        str = gli_streamlist;
-    }
-    else {
-        str = str->next;
-    }
+    str = gli_pool_next(&streampool, str);
     
     if (str) {
         if (rock)
@@ -513,7 +687,7 @@ strid_t glk_stream_iterate(strid_t str, glui32 *rock)
 
 glui32 glk_stream_get_rock(stream_t *str)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("stream_get_rock: invalid ref.");
         return 0;
     }
@@ -541,7 +715,7 @@ strid_t glk_stream_get_current()
 
 void glk_stream_set_position(stream_t *str, glsi32 pos, glui32 seekmode)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("stream_set_position: invalid ref");
         return;
     }
@@ -586,9 +760,25 @@ void glk_stream_set_position(stream_t *str, glsi32 pos, glui32 seekmode)
             /* do nothing; don't pass to echo stream */
             break;
         case strtype_File:
+            if (str->mapped) {
+                /* Use 4 here, rather than sizeof(glui32). UTF-8 text 
+                    files are positioned by byte. */
+                if (str->unicode && str->isbinary)
+                    pos *= 4;
+                if (seekmode == seekmode_Current)
+                    pos = (str->bufptr - str->buf) + pos;
+                else if (seekmode == seekmode_End)
+                    pos = (str->bufeof - str->buf) + pos;
+                if (pos < 0)
+                    pos = 0;
+                if (pos > (str->bufeof - str->buf))
+                    pos = (str->bufeof - str->buf);
+                str->bufptr = str->buf + pos;
+                break;
+            }
             /* Either reading or writing is legal after an fseek. */
             str->lastop = 0;
-            if (str->unicode) {
+            if (str->unicode && str->isbinary) {
                 /* Use 4 here, rather than sizeof(glui32). */
                 pos *= 4;
             }
@@ -601,7 +791,7 @@ void glk_stream_set_position(stream_t *str, glsi32 pos, glui32 seekmode)
 
 glui32 glk_stream_get_position(stream_t *str)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("stream_get_position: invalid ref");
         return 0;
     }
@@ -616,7 +806,13 @@ glui32 glk_stream_get_position(stream_t *str)
                 return (str->ubufptr - str->ubuf);
             }
         case strtype_File:
-            if (!str->unicode) {
+            if (str->mapped) {
+                if (!str->unicode || !str->isbinary)
+                    return (str->bufptr - str->buf);
+                else
+                    return (str->bufptr - str->buf) / 4;
+            }
+            if (!str->unicode || !str->isbinary) {
                 return ftell(str->file);
             }
             else {
@@ -640,916 +836,1281 @@ static void gli_stream_ensure_op(stream_t *str, glui32 op)
     str->lastop = op;
 }
 
-static void gli_put_char(stream_t *str, unsigned char ch)
+/* The per-kind stream functions. These are only reached through
+    str->ops, by the gli_put_* and gli_get_* calls further down, which
+    have already checked that the stream is writable (or readable) and
+    bumped the write count. (The get functions keep their own read
+    counts, since they know how much they actually read.) */
+
+/* A stream that can't be read from. (Window streams; the read calls
+    never get this far, but the table ought to be complete.) */
+
+static glsi32 null_get_char(stream_t *str, int want_unicode)
 {
-    if (!str || !str->writable)
-        return;
+    (void)str;
+    (void)want_unicode;
+    return -1;
+}
 
-    str->writecount++;
-    
-    switch (str->type) {
-        case strtype_Memory:
-            if (!str->unicode) {
-                if (str->bufptr < str->bufend) {
-                    *(str->bufptr) = ch;
-                    str->bufptr++;
-                    if (str->bufptr > str->bufeof)
-                        str->bufeof = str->bufptr;
-                }
-            }
-            else {
-                if (str->ubufptr < str->ubufend) {
-                    *(str->ubufptr) = (glui32)ch;
-                    str->ubufptr++;
-                    if (str->ubufptr > str->ubufeof)
-                        str->ubufeof = str->ubufptr;
-                }
-            }
-            break;
-        case strtype_Window:
-            if (str->win->line_request) {
-                gli_strict_warning("put_char: window has pending line request");
-                break;
-            }
-            gli_window_put_char(str->win, ch);
-            if (str->win->echostr)
-                gli_put_char(str->win->echostr, ch);
-            break;
-        case strtype_File:
-            gli_stream_ensure_op(str, filemode_Write);
-            /* Really, if the stream was opened in text mode, we ought to do 
-                character-set conversion here. As it is we're printing a
-                file of Latin-1 characters. */
-            if (!str->unicode) {
-                putc(ch, str->file);
-            }
-            else {
-                /* cheap big-endian stream */
-                putc(0, str->file);
-                putc(0, str->file);
-                putc(0, str->file);
-                putc(ch, str->file);
-            }
-            break;
-        case strtype_Resource:
-            /* resource streams are never writable */
-            break;
-    }
+static glui32 null_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    (void)str;
+    (void)cbuf;
+    (void)ubuf;
+    (void)len;
+    return 0;
 }
 
-#ifdef GLK_MODULE_UNICODE
+/* Memory streams with one-byte characters. Resource streams of text
+    which are not opened as unicode use these too. */
 
-static void gli_put_char_uni(stream_t *str, glui32 ch)
+static void memory8_put_char(stream_t *str, glui32 ch)
 {
-    if (!str || !str->writable)
-        return;
-
-    str->writecount++;
-    
-    switch (str->type) {
-        case strtype_Memory:
-            if (!str->unicode) {
-                if (ch >= 0x100)
-                    ch = '?';
-                if (str->bufptr < str->bufend) {
-                    *(str->bufptr) = ch;
-                    str->bufptr++;
-                    if (str->bufptr > str->bufeof)
-                        str->bufeof = str->bufptr;
-                }
-            }
-            else {
-                if (str->ubufptr < str->ubufend) {
-                    *(str->ubufptr) = ch;
-                    str->ubufptr++;
-                    if (str->ubufptr > str->ubufeof)
-                        str->ubufeof = str->ubufptr;
-                }
-            }
-            break;
-        case strtype_Window:
-            if (str->win->line_request) {
-                gli_strict_warning("put_char_uni: window has pending line request");
-                break;
-            }
-            gli_window_put_char(str->win, ((ch >= 0x100) ? '?' : ch));
-            if (str->win->echostr)
-                gli_put_char_uni(str->win->echostr, ch);
-            break;
-        case strtype_File:
-            gli_stream_ensure_op(str, filemode_Write);
-            if (!str->unicode) {
-                if (ch >= 0x100)
-                    ch = '?';
-                putc(ch, str->file);
-            }
-            else {
-                /* cheap big-endian stream */
-                putc(((ch >> 24) & 0xFF), str->file);
-                putc(((ch >> 16) & 0xFF), str->file);
-                putc(((ch >>  8) & 0xFF), str->file);
-                putc( (ch        & 0xFF), str->file);
-            }
-            break;
-        case strtype_Resource:
-            /* resource streams are never writable */
-            break;
+    if (ch >= 0x100)
+        ch = '?';
+    if (str->bufptr < str->bufend) {
+        *(str->bufptr) = ch;
+        str->bufptr++;
+        if (str->bufptr > str->bufeof)
+            str->bufeof = str->bufptr;
     }
 }
 
-#endif /* GLK_MODULE_UNICODE */
-
-static void gli_put_buffer(stream_t *str, char *buf, glui32 len)
+static void memory8_put_buffer(stream_t *str, char *buf, glui32 len)
 {
-    char *cx;
     glui32 lx;
     
-    if (!str || !str->writable)
-        return;
-
-    str->writecount += len;
-    
-    switch (str->type) {
-        case strtype_Memory:
-            if (!str->unicode) {
-                if (str->bufptr >= str->bufend) {
-                    len = 0;
-                }
-                else {
-                    if (str->bufptr + len > str->bufend) {
-                        lx = (str->bufptr + len) - str->bufend;
-                        if (lx < len)
-                            len -= lx;
-                        else
-                            len = 0;
-                    }
-                }
-                if (len) {
-                    memcpy(str->bufptr, buf, len);
-                    str->bufptr += len;
-                    if (str->bufptr > str->bufeof)
-                        str->bufeof = str->bufptr;
-                }
-            }
-            else {
-                if (str->ubufptr >= str->ubufend) {
-                    len = 0;
-                }
-                else {
-                    if (str->ubufptr + len > str->ubufend) {
-                        lx = (str->ubufptr + len) - str->ubufend;
-                        if (lx < len)
-                            len -= lx;
-                        else
-                            len = 0;
-                    }
-                }
-                if (len) {
-                    for (lx=0; lx<len; lx++) {
-                        *str->ubufptr = (unsigned char)(buf[lx]);
-                        str->ubufptr++;
-                    }
-                    if (str->ubufptr > str->ubufeof)
-                        str->ubufeof = str->ubufptr;
-                }
-            }
-            break;
-        case strtype_Window:
-            if (str->win->line_request) {
-                gli_strict_warning("put_buffer: window has pending line request");
-                break;
-            }
-            for (lx=0, cx=buf; lx<len; lx++, cx++) {
-                gli_window_put_char(str->win, *cx);
-            }
-            if (str->win->echostr)
-                gli_put_buffer(str->win->echostr, buf, len);
-            break;
-        case strtype_File:
-            gli_stream_ensure_op(str, filemode_Write);
-            /* Really, if the stream was opened in text mode, we ought to do 
-                character-set conversion here. As it is we're printing a
-                file of Latin-1 characters. */
-            if (!str->unicode) {
-                fwrite((unsigned char *)buf, 1, len, str->file);
-            }
-            else {
-                /* cheap big-endian stream */
-                for (lx=0; lx<len; lx++) {
-                    unsigned char ch = ((unsigned char *)buf)[lx];
-                    putc(((ch >> 24) & 0xFF), str->file);
-                    putc(((ch >> 16) & 0xFF), str->file);
-                    putc(((ch >>  8) & 0xFF), str->file);
-                    putc( (ch        & 0xFF), str->file);
-                }
-            }
-            break;
-        case strtype_Resource:
-            /* resource streams are never writable */
-            break;
+    if (str->bufptr >= str->bufend) {
+        len = 0;
+    }
+    else {
+        if (str->bufptr + len > str->bufend) {
+            lx = (str->bufptr + len) - str->bufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    if (len) {
+        memcpy(str->bufptr, buf, len);
+        str->bufptr += len;
+        if (str->bufptr > str->bufeof)
+            str->bufeof = str->bufptr;
     }
 }
 
-static void gli_set_style(stream_t *str, glui32 val)
+static void memory8_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
 {
-    if (!str || !str->writable)
-        return;
-
-    if (val >= style_NUMSTYLES)
-        val = 0;
+    glui32 lx, ch;
     
-    switch (str->type) {
-        case strtype_Window:
-            str->win->style = val;
-            if (str->win->echostr)
-                gli_set_style(str->win->echostr, val);
-            break;
+    if (str->bufptr >= str->bufend) {
+        len = 0;
+    }
+    else {
+        if (str->bufptr + len > str->bufend) {
+            lx = (str->bufptr + len) - str->bufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    if (len) {
+        for (lx=0; lx<len; lx++) {
+            ch = buf[lx];
+            if (ch >= 0x100)
+                ch = '?';
+            str->bufptr[lx] = ch;
+        }
+        str->bufptr += len;
+        if (str->bufptr > str->bufeof)
+            str->bufeof = str->bufptr;
     }
 }
 
-void gli_stream_echo_line(stream_t *str, char *buf, glui32 len)
+static glsi32 memory8_get_char(stream_t *str, int want_unicode)
 {
-    /* This is only used to echo line input to an echo stream. See
-        the line input methods in gtw_grid and gtw_buf. */
-    gli_put_buffer(str, buf, len);
-    gli_put_char(str, '\n');
+    unsigned char ch;
+    
+    (void)want_unicode;
+    if (str->bufptr >= str->bufend)
+        return -1;
+    ch = *(str->bufptr);
+    str->bufptr++;
+    str->readcount++;
+    return ch;
 }
 
-#ifdef GLK_MODULE_UNICODE
-
-void gli_stream_echo_line_uni(stream_t *str, glui32 *buf, glui32 len)
+static glui32 memory8_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
 {
-    glui32 ix;
-    /* This is only used to echo line input to an echo stream. See
-        glk_select(). */
-    for (ix=0; ix<len; ix++) {
-        gli_put_char_uni(str, buf[ix]);
+    glui32 lx;
+    
+    if (str->bufptr >= str->bufend) {
+        len = 0;
     }
-    gli_put_char(str, '\n');
+    else {
+        if (str->bufptr + len > str->bufend) {
+            lx = (str->bufptr + len) - str->bufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    if (len) {
+        if (cbuf) {
+            memcpy(cbuf, str->bufptr, len);
+        }
+        else {
+            for (lx=0; lx<len; lx++) {
+                ubuf[lx] = (unsigned char)str->bufptr[lx];
+            }
+        }
+        str->bufptr += len;
+        if (str->bufptr > str->bufeof)
+            str->bufeof = str->bufptr;
+    }
+    str->readcount += len;
+    return len;
 }
 
-#else
-
-void gli_stream_echo_line_uni(stream_t *str, glui32 *buf, glui32 len)
+static glui32 memory8_get_line(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
 {
-    gli_strict_warning("stream_echo_line_uni: called with no Unicode line request");
-}
-
-#endif /* GLK_MODULE_UNICODE */
+    glui32 lx;
+    int gotnewline;
 
-static glsi32 gli_get_char(stream_t *str, int want_unicode)
+    if (len == 0)
+        return 0;
+    len -= 1; /* for the terminal null */
+    if (str->bufptr >= str->bufend) {
+        len = 0;
+    }
+    else {
+        if (str->bufptr + len > str->bufend) {
+            lx = (str->bufptr + len) - str->bufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    gotnewline = FALSE;
+    if (cbuf) {
+        for (lx=0; lx<len && !gotnewline; lx++) {
+            cbuf[lx] = str->bufptr[lx];
+            gotnewline = (cbuf[lx] == '\n');
+        }
+        cbuf[lx] = '\0';
+    }
+    else {
+        for (lx=0; lx<len && !gotnewline; lx++) {
+            ubuf[lx] = (unsigned char)str->bufptr[lx];
+            gotnewline = (ubuf[lx] == '\n');
+        }
+        ubuf[lx] = '\0';
+    }
+    str->bufptr += lx;
+    str->readcount += lx;
+    return lx;
+}
+
+/* Memory streams with four-byte characters. */
+
+static void memory32_put_char(stream_t *str, glui32 ch)
 {
-    if (!str || !str->readable)
+    if (str->ubufptr < str->ubufend) {
+        *(str->ubufptr) = ch;
+        str->ubufptr++;
+        if (str->ubufptr > str->ubufeof)
+            str->ubufeof = str->ubufptr;
+    }
+}
+
+static void memory32_put_buffer(stream_t *str, char *buf, glui32 len)
+{
+    glui32 lx;
+    
+    if (str->ubufptr >= str->ubufend) {
+        len = 0;
+    }
+    else {
+        if (str->ubufptr + len > str->ubufend) {
+            lx = (str->ubufptr + len) - str->ubufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    if (len) {
+        for (lx=0; lx<len; lx++) {
+            *str->ubufptr = (unsigned char)(buf[lx]);
+            str->ubufptr++;
+        }
+        if (str->ubufptr > str->ubufeof)
+            str->ubufeof = str->ubufptr;
+    }
+}
+
+static void memory32_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    glui32 lx;
+    
+    if (str->ubufptr >= str->ubufend) {
+        len = 0;
+    }
+    else {
+        if (str->ubufptr + len > str->ubufend) {
+            lx = (str->ubufptr + len) - str->ubufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    if (len) {
+        memcpy(str->ubufptr, buf, len * sizeof(glui32));
+        str->ubufptr += len;
+        if (str->ubufptr > str->ubufeof)
+            str->ubufeof = str->ubufptr;
+    }
+}
+
+static glsi32 memory32_get_char(stream_t *str, int want_unicode)
+{
+    glui32 ch;
+    
+    if (str->ubufptr >= str->ubufend)
         return -1;
+    ch = *(str->ubufptr);
+    str->ubufptr++;
+    str->readcount++;
+    if (!want_unicode && ch >= 0x100)
+        return '?';
+    return ch;
+}
+
+static glui32 memory32_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 lx, ch;
     
-    switch (str->type) {
-        case strtype_Resource:
-            if (str->unicode) {
-                glui32 ch;
-                if (str->isbinary) {
-                    /* cheap big-endian stream */
-                    if (str->bufptr >= str->bufend)
-                        return -1;
-                    ch = *(str->bufptr);
-                    str->bufptr++;
-                    if (str->bufptr >= str->bufend)
-                        return -1;
-                    ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                    str->bufptr++;
-                    if (str->bufptr >= str->bufend)
-                        return -1;
-                    ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                    str->bufptr++;
-                    if (str->bufptr >= str->bufend)
-                        return -1;
-                    ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                    str->bufptr++;
-                }
-                else {
-                    /* slightly less cheap UTF8 stream */
-                    glui32 val0, val1, val2, val3;
-                    if (str->bufptr >= str->bufend)
-                        return -1;
-                    val0 = *(str->bufptr);
-                    str->bufptr++;
-                    if (val0 < 0x80) {
-                        ch = val0;
-                    }
-                    else {
-                        if (str->bufptr >= str->bufend)
-                            return -1;
-                        val1 = *(str->bufptr);
-                        str->bufptr++;
-                        if ((val1 & 0xC0) != 0x80)
-                            return -1;
-                        if ((val0 & 0xE0) == 0xC0) {
-                            ch = (val0 & 0x1F) << 6;
-                            ch |= (val1 & 0x3F);
-                        }
-                        else {
-                            if (str->bufptr >= str->bufend)
-                                return -1;
-                            val2 = *(str->bufptr);
-                            str->bufptr++;
-                            if ((val2 & 0xC0) != 0x80)
-                                return -1;
-                            if ((val0 & 0xF0) == 0xE0) {
-                                ch = (((val0 & 0xF)<<12)  & 0x0000F000);
-                                ch |= (((val1 & 0x3F)<<6) & 0x00000FC0);
-                                ch |= (((val2 & 0x3F))    & 0x0000003F);
-                            }
-                            else if ((val0 & 0xF0) == 0xF0) {
-                                if (str->bufptr >= str->bufend)
-                                    return -1;
-                                val3 = *(str->bufptr);
-                                str->bufptr++;
-                                if ((val3 & 0xC0) != 0x80)
-                                    return -1;
-                                ch = (((val0 & 0x7)<<18)   & 0x1C0000);
-                                ch |= (((val1 & 0x3F)<<12) & 0x03F000);
-                                ch |= (((val2 & 0x3F)<<6)  & 0x000FC0);
-                                ch |= (((val3 & 0x3F))     & 0x00003F);
-                            }
-                            else {
-                                return -1;
-                            }
-                        }
-                    }
-                }
-                str->readcount++;
-                if (!want_unicode && ch >= 0x100)
-                    return '?';
-                return (glsi32)ch;
-            }
-            /* for text streams, fall through to memory case */
-        case strtype_Memory:
-            if (!str->unicode) {
-                if (str->bufptr < str->bufend) {
-                    unsigned char ch;
-                    ch = *(str->bufptr);
-                    str->bufptr++;
-                    str->readcount++;
-                    return ch;
-                }
-                else {
-                    return -1;
-                }
-            }
-            else {
-                if (str->ubufptr < str->ubufend) {
-                    glui32 ch;
-                    ch = *(str->ubufptr);
-                    str->ubufptr++;
-                    str->readcount++;
-                    if (!want_unicode && ch >= 0x100)
-                        return '?';
-                    return ch;
-                }
-                else {
-                    return -1;
-                }
-            }
-        case strtype_File: 
-            gli_stream_ensure_op(str, filemode_Read);
-            if (!str->unicode) {
-                int res;
-                res = getc(str->file);
-                if (res != -1) {
-                    str->readcount++;
-                    /* Really, if the stream was opened in text mode, we ought
-                       to do character-set conversion here. */
-                    return (glsi32)res;
-                }
-                else {
-                    return -1;
-                }
+    if (str->ubufptr >= str->ubufend) {
+        len = 0;
+    }
+    else {
+        if (str->ubufptr + len > str->ubufend) {
+            lx = (str->ubufptr + len) - str->ubufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    if (len) {
+        if (cbuf) {
+            for (lx=0; lx<len; lx++) {
+                ch = str->ubufptr[lx];
+                if (ch >= 0x100)
+                    ch = '?';
+                cbuf[lx] = ch;
             }
-            else {
-                /* cheap big-endian stream */
-                int res;
-                glui32 ch;
-                res = getc(str->file);
-                if (res == -1)
-                    return -1;
-                ch = (res & 0xFF);
-                res = getc(str->file);
-                if (res == -1)
-                    return -1;
-                ch = (ch << 8) | (res & 0xFF);
-                res = getc(str->file);
-                if (res == -1)
-                    return -1;
-                ch = (ch << 8) | (res & 0xFF);
-                res = getc(str->file);
-                if (res == -1)
-                    return -1;
-                ch = (ch << 8) | (res & 0xFF);
-                str->readcount++;
-                if (!want_unicode && ch >= 0x100)
-                    return '?';
-                return (glsi32)ch;
+        }
+        else {
+            for (lx=0; lx<len; lx++) {
+                ubuf[lx] = str->ubufptr[lx];
             }
-        case strtype_Window:
-        default:
-            return -1;
+        }
+        str->ubufptr += len;
+        if (str->ubufptr > str->ubufeof)
+            str->ubufeof = str->ubufptr;
     }
+    str->readcount += len;
+    return len;
 }
 
-static glui32 gli_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+static glui32 memory32_get_line(stream_t *str, char *cbuf, glui32 *ubuf,
     glui32 len)
 {
-    if (!str || !str->readable)
+    glui32 lx, ch;
+    int gotnewline;
+
+    if (len == 0)
         return 0;
+    len -= 1; /* for the terminal null */
+    if (str->ubufptr >= str->ubufend) {
+        len = 0;
+    }
+    else {
+        if (str->ubufptr + len > str->ubufend) {
+            lx = (str->ubufptr + len) - str->ubufend;
+            if (lx < len)
+                len -= lx;
+            else
+                len = 0;
+        }
+    }
+    gotnewline = FALSE;
+    if (cbuf) {
+        for (lx=0; lx<len && !gotnewline; lx++) {
+            ch = str->ubufptr[lx];
+            if (ch >= 0x100)
+                ch = '?';
+            cbuf[lx] = ch;
+            gotnewline = (ch == '\n');
+        }
+        cbuf[lx] = '\0';
+    }
+    else {
+        for (lx=0; lx<len && !gotnewline; lx++) {
+            ch = str->ubufptr[lx];
+            ubuf[lx] = ch;
+            gotnewline = (ch == '\n');
+        }
+        ubuf[lx] = '\0';
+    }
+    str->ubufptr += lx;
+    str->readcount += lx;
+    return lx;
+}
+
+/* File streams with one-byte characters. Really, if the stream was 
+    opened in text mode, we ought to do character-set conversion here. 
+    As it is we're reading and writing files of Latin-1 characters. */
+
+static void file8_put_char(stream_t *str, glui32 ch)
+{
+    gli_stream_ensure_op(str, filemode_Write);
+    if (ch >= 0x100)
+        ch = '?';
+    putc(ch, str->file);
+}
+
+static void file8_put_buffer(stream_t *str, char *buf, glui32 len)
+{
+    gli_stream_ensure_op(str, filemode_Write);
+    fwrite((unsigned char *)buf, 1, len, str->file);
+}
+
+static void file8_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    unsigned char block[STREAM_BLOCK_CHARS];
+    glui32 lx, count, ch;
     
-    switch (str->type) {
-        case strtype_Resource:
-            if (str->unicode) {
-                glui32 count = 0;
-                while (count < len) {
-                    glui32 ch;
-                    if (str->isbinary) {
-                        /* cheap big-endian stream */
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = *(str->bufptr);
-                        str->bufptr++;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                        str->bufptr++;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                        str->bufptr++;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                        str->bufptr++;
-                    }
-                    else {
-                        /* slightly less cheap UTF8 stream */
-                        glui32 val0, val1, val2, val3;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        val0 = *(str->bufptr);
-                        str->bufptr++;
-                        if (val0 < 0x80) {
-                            ch = val0;
-                        }
-                        else {
-                            if (str->bufptr >= str->bufend)
-                                break;
-                            val1 = *(str->bufptr);
-                            str->bufptr++;
-                            if ((val1 & 0xC0) != 0x80)
-                                break;
-                            if ((val0 & 0xE0) == 0xC0) {
-                                ch = (val0 & 0x1F) << 6;
-                                ch |= (val1 & 0x3F);
-                            }
-                            else {
-                                if (str->bufptr >= str->bufend)
-                                    break;
-                                val2 = *(str->bufptr);
-                                str->bufptr++;
-                                if ((val2 & 0xC0) != 0x80)
-                                    break;
-                                if ((val0 & 0xF0) == 0xE0) {
-                                    ch = (((val0 & 0xF)<<12)  & 0x0000F000);
-                                    ch |= (((val1 & 0x3F)<<6) & 0x00000FC0);
-                                    ch |= (((val2 & 0x3F))    & 0x0000003F);
-                                }
-                                else if ((val0 & 0xF0) == 0xF0) {
-                                    if (str->bufptr >= str->bufend)
-                                        break;
-                                    val3 = *(str->bufptr);
-                                    str->bufptr++;
-                                    if ((val3 & 0xC0) != 0x80)
-                                        break;
-                                    ch = (((val0 & 0x7)<<18)   & 0x1C0000);
-                                    ch |= (((val1 & 0x3F)<<12) & 0x03F000);
-                                    ch |= (((val2 & 0x3F)<<6)  & 0x000FC0);
-                                    ch |= (((val3 & 0x3F))     & 0x00003F);
-                                }
-                                else {
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    if (cbuf) {
-                        if (ch >= 0x100)
-                            cbuf[count] = '?';
-                        else
-                            cbuf[count] = ch;
-                    }
-                    else {
-                        ubuf[count] = ch;
-                    }
-                    count++;
-                }
-                str->readcount += count;
-                return count;
-            }
-            /* for text streams, fall through to memory case */
-        case strtype_Memory:
-            if (!str->unicode) {
-                if (str->bufptr >= str->bufend) {
-                    len = 0;
-                }
-                else {
-                    if (str->bufptr + len > str->bufend) {
-                        glui32 lx;
-                        lx = (str->bufptr + len) - str->bufend;
-                        if (lx < len)
-                            len -= lx;
-                        else
-                            len = 0;
-                    }
-                }
-                if (len) {
-                    if (cbuf) {
-                        memcpy(cbuf, str->bufptr, len);
-                    }
-                    else {
-                        glui32 lx;
-                        for (lx=0; lx<len; lx++) {
-                            ubuf[lx] = (unsigned char)str->bufptr[lx];
-                        }
-                    }
-                    str->bufptr += len;
-                    if (str->bufptr > str->bufeof)
-                        str->bufeof = str->bufptr;
-                }
-            }
-            else {
-                if (str->ubufptr >= str->ubufend) {
-                    len = 0;
-                }
-                else {
-                    if (str->ubufptr + len > str->ubufend) {
-                        glui32 lx;
-                        lx = (str->ubufptr + len) - str->ubufend;
-                        if (lx < len)
-                            len -= lx;
-                        else
-                            len = 0;
-                    }
-                }
-                if (len) {
-                    glui32 lx, ch;
-                    if (cbuf) {
-                        for (lx=0; lx<len; lx++) {
-                            ch = str->ubufptr[lx];
-                            if (ch >= 0x100)
-                                ch = '?';
-                            cbuf[lx] = ch;
-                        }
-                    }
-                    else {
-                        for (lx=0; lx<len; lx++) {
-                            ubuf[lx] = str->ubufptr[lx];
-                        }
-                    }
-                    str->ubufptr += len;
-                    if (str->ubufptr > str->ubufeof)
-                        str->ubufeof = str->ubufptr;
-                }
-            }
-            str->readcount += len;
-            return len;
-        case strtype_File: 
-            gli_stream_ensure_op(str, filemode_Read);
-            if (!str->unicode) {
-                if (cbuf) {
-                    glui32 res;
-                    res = fread(cbuf, 1, len, str->file);
-                    /* Really, if the stream was opened in text mode, we ought
-                       to do character-set conversion here. */
-                    str->readcount += res;
-                    return res;
-                }
-                else {
-                    glui32 lx;
-                    for (lx=0; lx<len; lx++) {
-                        int res;
-                        glui32 ch;
-                        res = getc(str->file);
-                        if (res == -1)
-                            break;
-                        ch = (res & 0xFF);
-                        str->readcount++;
-                        ubuf[lx] = ch;
-                    }
-                    return lx;
-                }
-            }
-            else {
-                glui32 lx;
-                for (lx=0; lx<len; lx++) {
-                    int res;
-                    glui32 ch;
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (res & 0xFF);
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (ch << 8) | (res & 0xFF);
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (ch << 8) | (res & 0xFF);
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (ch << 8) | (res & 0xFF);
-                    str->readcount++;
-                    if (cbuf) {
-                        if (ch >= 0x100)
-                            ch = '?';
-                        cbuf[lx] = ch;
-                    }
-                    else {
-                        ubuf[lx] = ch;
-                    }
-                }
-                return lx;
-            }
-        case strtype_Window:
-        default:
-            return 0;
+    gli_stream_ensure_op(str, filemode_Write);
+    while (len) {
+        count = (len < STREAM_BLOCK_CHARS) ? len : STREAM_BLOCK_CHARS;
+        for (lx=0; lx<count; lx++) {
+            ch = buf[lx];
+            if (ch >= 0x100)
+                ch = '?';
+            block[lx] = ch;
+        }
+        fwrite(block, 1, count, str->file);
+        buf += count;
+        len -= count;
     }
 }
 
-static glui32 gli_get_line(stream_t *str, char *cbuf, glui32 *ubuf, 
+static glsi32 file8_get_char(stream_t *str, int want_unicode)
+{
+    int res;
+    
+    (void)want_unicode;
+    gli_stream_ensure_op(str, filemode_Read);
+    res = getc(str->file);
+    if (res == -1)
+        return -1;
+    str->readcount++;
+    return (glsi32)res;
+}
+
+static glui32 file8_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
     glui32 len)
 {
     glui32 lx;
+    int res;
+    
+    gli_stream_ensure_op(str, filemode_Read);
+    if (cbuf) {
+        lx = fread(cbuf, 1, len, str->file);
+        str->readcount += lx;
+        return lx;
+    }
+    for (lx=0; lx<len; lx++) {
+        res = getc(str->file);
+        if (res == -1)
+            break;
+        str->readcount++;
+        ubuf[lx] = (res & 0xFF);
+    }
+    return lx;
+}
+
+static glui32 file8_get_line(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 lx;
+    int res, gotnewline;
+    
+    gli_stream_ensure_op(str, filemode_Read);
+    if (cbuf) {
+        if (!fgets(cbuf, len, str->file))
+            return 0;
+        lx = strlen(cbuf);
+        str->readcount += lx;
+        return lx;
+    }
+    if (len == 0)
+        return 0;
+    len -= 1; /* for the terminal null */
+    gotnewline = FALSE;
+    for (lx=0; lx<len && !gotnewline; lx++) {
+        res = getc(str->file);
+        if (res == -1)
+            break;
+        str->readcount++;
+        ubuf[lx] = (res & 0xFF);
+        gotnewline = (ubuf[lx] == '\n');
+    }
+    ubuf[lx] = '\0';
+    return lx;
+}
+
+/* File streams with four-byte characters. This is a cheap big-endian
+    stream. (Use 4 here, rather than sizeof(glui32).) Buffers of 
+    characters are converted a block at a time, and each block goes 
+    through a single fwrite() or fread(). */
+
+#ifdef USE_SSE2_STREAMS
+
+/* Reverse the bytes of each of the four glui32s in a block. This is its
+    own inverse, so it serves for encoding and decoding. (SSE2 implies a
+    little-endian machine.) */
+static __m128i swap_block(__m128i block)
+{
+    block = _mm_or_si128(_mm_slli_epi16(block, 8), _mm_srli_epi16(block, 8));
+    block = _mm_shufflelo_epi16(block, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(block, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+#endif /* USE_SSE2_STREAMS */
+
+/* Convert count characters to big-endian bytes. */
+static void encode_be32(unsigned char *dest, glui32 *src, glui32 count)
+{
+    glui32 ix = 0;
+    
+#ifdef USE_SSE2_STREAMS
+    while (ix + 4 <= count) {
+        _mm_storeu_si128((__m128i *)(dest + 4*ix),
+            swap_block(_mm_loadu_si128((__m128i *)(src + ix))));
+        ix += 4;
+    }
+#endif /* USE_SSE2_STREAMS */
+    
+    for (; ix<count; ix++) {
+        dest[4*ix]   = ((src[ix] >> 24) & 0xFF);
+        dest[4*ix+1] = ((src[ix] >> 16) & 0xFF);
+        dest[4*ix+2] = ((src[ix] >>  8) & 0xFF);
+        dest[4*ix+3] =  (src[ix]        & 0xFF);
+    }
+}
+
+/* Convert count characters from big-endian bytes. */
+static void decode_be32(glui32 *dest, unsigned char *src, glui32 count)
+{
+    glui32 ix = 0;
+    
+#ifdef USE_SSE2_STREAMS
+    while (ix + 4 <= count) {
+        _mm_storeu_si128((__m128i *)(dest + ix),
+            swap_block(_mm_loadu_si128((__m128i *)(src + 4*ix))));
+        ix += 4;
+    }
+#endif /* USE_SSE2_STREAMS */
+    
+    for (; ix<count; ix++) {
+        dest[ix] = ((glui32)src[4*ix] << 24) | ((glui32)src[4*ix+1] << 16)
+            | ((glui32)src[4*ix+2] << 8) | (glui32)src[4*ix+3];
+    }
+}
+
+static int file32_read(stream_t *str, glui32 *chp)
+{
+    int ix, res;
+    glui32 ch = 0;
+    
+    for (ix=0; ix<4; ix++) {
+        res = getc(str->file);
+        if (res == -1)
+            return FALSE;
+        ch = (ch << 8) | (res & 0xFF);
+    }
+    *chp = ch;
+    return TRUE;
+}
+
+static void file32_put_char(stream_t *str, glui32 ch)
+{
+    gli_stream_ensure_op(str, filemode_Write);
+    putc(((ch >> 24) & 0xFF), str->file);
+    putc(((ch >> 16) & 0xFF), str->file);
+    putc(((ch >>  8) & 0xFF), str->file);
+    putc( (ch        & 0xFF), str->file);
+}
+
+static void file32_put_buffer(stream_t *str, char *buf, glui32 len)
+{
+    unsigned char block[4*STREAM_BLOCK_CHARS];
+    glui32 lx, count;
+    
+    gli_stream_ensure_op(str, filemode_Write);
+    memset(block, 0, sizeof(block));
+    while (len) {
+        count = (len < STREAM_BLOCK_CHARS) ? len : STREAM_BLOCK_CHARS;
+        for (lx=0; lx<count; lx++)
+            block[4*lx+3] = buf[lx];
+        fwrite(block, 4, count, str->file);
+        buf += count;
+        len -= count;
+    }
+}
+
+static void file32_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    unsigned char block[4*STREAM_BLOCK_CHARS];
+    glui32 count;
+    
+    gli_stream_ensure_op(str, filemode_Write);
+    while (len) {
+        count = (len < STREAM_BLOCK_CHARS) ? len : STREAM_BLOCK_CHARS;
+        encode_be32(block, buf, count);
+        fwrite(block, 4, count, str->file);
+        buf += count;
+        len -= count;
+    }
+}
+
+static glsi32 file32_get_char(stream_t *str, int want_unicode)
+{
+    glui32 ch;
+    
+    gli_stream_ensure_op(str, filemode_Read);
+    if (!file32_read(str, &ch))
+        return -1;
+    str->readcount++;
+    if (!want_unicode && ch >= 0x100)
+        return '?';
+    return (glsi32)ch;
+}
+
+static glui32 file32_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    unsigned char block[4*STREAM_BLOCK_CHARS];
+    glui32 lx, count, got, total, ch;
+    
+    gli_stream_ensure_op(str, filemode_Read);
+    total = 0;
+    while (total < len) {
+        count = len - total;
+        if (count > STREAM_BLOCK_CHARS)
+            count = STREAM_BLOCK_CHARS;
+        /* A partial character at the end of the file is dropped, as it
+            always has been. */
+        got = fread(block, 4, count, str->file);
+        if (ubuf) {
+            decode_be32(ubuf+total, block, got);
+        }
+        else {
+            for (lx=0; lx<got; lx++) {
+                ch = block[4*lx+3];
+                if (block[4*lx] || block[4*lx+1] || block[4*lx+2])
+                    ch = '?';
+                cbuf[total+lx] = ch;
+            }
+        }
+        total += got;
+        if (got < count)
+            break;
+    }
+    str->readcount += total;
+    return total;
+}
+
+/* This can't read ahead a block, because it has to stop at the newline
+    and stdio won't take back more than one byte. */
+static glui32 file32_get_line(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 lx, ch;
     int gotnewline;
+    
+    if (len == 0)
+        return 0;
+    len -= 1; /* for the terminal null */
+    gli_stream_ensure_op(str, filemode_Read);
+    gotnewline = FALSE;
+    for (lx=0; lx<len && !gotnewline; lx++) {
+        if (!file32_read(str, &ch))
+            break;
+        str->readcount++;
+        gotnewline = (ch == '\n');
+        if (cbuf) {
+            if (ch >= 0x100)
+                ch = '?';
+            cbuf[lx] = ch;
+        }
+        else {
+            ubuf[lx] = ch;
+        }
+    }
+    if (cbuf)
+        cbuf[lx] = '\0';
+    else 
+        ubuf[lx] = '\0';
+    return lx;
+}
 
-    if (!str || !str->readable)
+/* File streams with four-byte characters, opened in text mode. These
+    are UTF-8. Runs of plain ASCII, which is most of any transcript, are
+    passed through in bulk; only the other characters are encoded or 
+    decoded one at a time. */
+
+/* Return the length of the run of ASCII bytes at the start of ptr (no
+    more than len). If stopnl is set, the run also ends before a 
+    newline. */
+static glui32 scan_ascii(unsigned char *ptr, glui32 len, int stopnl)
+{
+    glui32 ix = 0;
+#ifdef USE_SSE2_STREAMS
+    __m128i newlines = _mm_set1_epi8('\n');
+    __m128i block;
+    int mask;
+    
+    while (ix + 16 <= len) {
+        block = _mm_loadu_si128((__m128i *)(ptr+ix));
+        mask = _mm_movemask_epi8(block);
+        if (stopnl)
+            mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+        if (mask)
+            return ix + __builtin_ctz(mask);
+        ix += 16;
+    }
+#endif /* USE_SSE2_STREAMS */
+    
+    while (ix < len && ptr[ix] < 0x80 && !(stopnl && ptr[ix] == '\n'))
+        ix++;
+    return ix;
+}
+
+/* Copy count bytes into an array of glui32s. */
+static void widen_ascii(glui32 *dest, unsigned char *src, glui32 count)
+{
+    glui32 ix = 0;
+#ifdef USE_SSE2_STREAMS
+    __m128i zero = _mm_setzero_si128();
+    __m128i block, lo, hi;
+    
+    while (ix + 16 <= count) {
+        block = _mm_loadu_si128((__m128i *)(src+ix));
+        lo = _mm_unpacklo_epi8(block, zero);
+        hi = _mm_unpackhi_epi8(block, zero);
+        _mm_storeu_si128((__m128i *)(dest+ix), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(dest+ix+4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(dest+ix+8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(dest+ix+12), _mm_unpackhi_epi16(hi, zero));
+        ix += 16;
+    }
+#endif /* USE_SSE2_STREAMS */
+    
+    for (; ix<count; ix++)
+        dest[ix] = src[ix];
+}
+
+/* Encode count characters as UTF-8. The dest array must have room for
+    four bytes per character. Returns the number of bytes used. (The
+    multi-byte cases are the same as gli_putchar_utf8().) */
+static glui32 encode_utf8(unsigned char *dest, glui32 *src, glui32 count)
+{
+    glui32 ix = 0, pos = 0, val;
+#ifdef USE_SSE2_STREAMS
+    __m128i highbits = _mm_set1_epi32(-0x80);
+    __m128i zero = _mm_setzero_si128();
+    __m128i b0, b1, b2, b3;
+#endif /* USE_SSE2_STREAMS */
+    
+    while (ix < count) {
+#ifdef USE_SSE2_STREAMS
+        while (ix + 16 <= count) {
+            b0 = _mm_loadu_si128((__m128i *)(src+ix));
+            b1 = _mm_loadu_si128((__m128i *)(src+ix+4));
+            b2 = _mm_loadu_si128((__m128i *)(src+ix+8));
+            b3 = _mm_loadu_si128((__m128i *)(src+ix+12));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(zero, _mm_and_si128(highbits,
+                _mm_or_si128(_mm_or_si128(b0, b1), _mm_or_si128(b2, b3)))))
+                != 0xFFFF)
+                break;
+            /* All sixteen are ASCII, so the saturating packs are exact. */
+            _mm_storeu_si128((__m128i *)(dest+pos), 
+                _mm_packus_epi16(_mm_packs_epi32(b0, b1), 
+                    _mm_packs_epi32(b2, b3)));
+            ix += 16;
+            pos += 16;
+        }
+        if (ix >= count)
+            break;
+#endif /* USE_SSE2_STREAMS */
+        val = src[ix++];
+        if (val < 0x80) {
+            dest[pos++] = val;
+        }
+        else if (val < 0x800) {
+            dest[pos++] = (0xC0 | ((val & 0x7C0) >> 6));
+            dest[pos++] = (0x80 |  (val & 0x03F)     );
+        }
+        else if (val < 0x10000) {
+            dest[pos++] = (0xE0 | ((val & 0xF000) >> 12));
+            dest[pos++] = (0x80 | ((val & 0x0FC0) >>  6));
+            dest[pos++] = (0x80 |  (val & 0x003F)      );
+        }
+        else if (val < 0x200000) {
+            dest[pos++] = (0xF0 | ((val & 0x1C0000) >> 18));
+            dest[pos++] = (0x80 | ((val & 0x03F000) >> 12));
+            dest[pos++] = (0x80 | ((val & 0x000FC0) >>  6));
+            dest[pos++] = (0x80 |  (val & 0x00003F)      );
+        }
+        else {
+            dest[pos++] = '?';
+        }
+    }
+    return pos;
+}
+
+/* Read one UTF-8 character through stdio. A malformed sequence ends the
+    stream, as it does for resources. */
+static int fileutf8_read(stream_t *str, glui32 *chp)
+{
+    int res, extra;
+    glui32 ch;
+    
+    res = getc(str->file);
+    if (res == -1)
+        return FALSE;
+    if (res < 0x80) {
+        *chp = res;
+        return TRUE;
+    }
+    if ((res & 0xE0) == 0xC0) {
+        ch = (res & 0x1F);
+        extra = 1;
+    }
+    else if ((res & 0xF0) == 0xE0) {
+        ch = (res & 0x0F);
+        extra = 2;
+    }
+    else if ((res & 0xF8) == 0xF0) {
+        ch = (res & 0x07);
+        extra = 3;
+    }
+    else {
+        return FALSE;
+    }
+    while (extra--) {
+        res = getc(str->file);
+        if (res == -1 || (res & 0xC0) != 0x80)
+            return FALSE;
+        ch = (ch << 6) | (res & 0x3F);
+    }
+    *chp = ch;
+    return TRUE;
+}
+
+static void fileutf8_put_char(stream_t *str, glui32 ch)
+{
+    gli_stream_ensure_op(str, filemode_Write);
+    gli_putchar_utf8(ch, str->file);
+}
+
+static void fileutf8_put_buffer(stream_t *str, char *buf, glui32 len)
+{
+    unsigned char *ptr = (unsigned char *)buf;
+    glui32 run;
+    
+    gli_stream_ensure_op(str, filemode_Write);
+    while (len) {
+        run = scan_ascii(ptr, len, FALSE);
+        if (run) {
+            fwrite(ptr, 1, run, str->file);
+            ptr += run;
+            len -= run;
+        }
+        else {
+            gli_putchar_utf8(*ptr, str->file);
+            ptr++;
+            len--;
+        }
+    }
+}
+
+static void fileutf8_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    unsigned char block[4*STREAM_BLOCK_CHARS];
+    glui32 count;
+    
+    gli_stream_ensure_op(str, filemode_Write);
+    while (len) {
+        count = (len < STREAM_BLOCK_CHARS) ? len : STREAM_BLOCK_CHARS;
+        fwrite(block, 1, encode_utf8(block, buf, count), str->file);
+        buf += count;
+        len -= count;
+    }
+}
+
+static glsi32 fileutf8_get_char(stream_t *str, int want_unicode)
+{
+    glui32 ch;
+    
+    gli_stream_ensure_op(str, filemode_Read);
+    if (!fileutf8_read(str, &ch))
+        return -1;
+    str->readcount++;
+    if (!want_unicode && ch >= 0x100)
+        return '?';
+    return (glsi32)ch;
+}
+
+/* The reading side goes a character at a time, since stdio can't give
+    back the part of a block beyond the last character wanted. (A file
+    opened only for reading is mapped, if possible, and then decoded by
+    resource_get_buffer() with the fast path.) */
+static glui32 fileutf8_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 lx, ch;
+    
+    gli_stream_ensure_op(str, filemode_Read);
+    for (lx=0; lx<len; lx++) {
+        if (!fileutf8_read(str, &ch))
+            break;
+        str->readcount++;
+        if (cbuf) {
+            if (ch >= 0x100)
+                ch = '?';
+            cbuf[lx] = ch;
+        }
+        else {
+            ubuf[lx] = ch;
+        }
+    }
+    return lx;
+}
+
+static glui32 fileutf8_get_line(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 lx, ch;
+    int gotnewline;
+    
+    if (len == 0)
         return 0;
+    len -= 1; /* for the terminal null */
+    gli_stream_ensure_op(str, filemode_Read);
+    gotnewline = FALSE;
+    for (lx=0; lx<len && !gotnewline; lx++) {
+        if (!fileutf8_read(str, &ch))
+            break;
+        str->readcount++;
+        gotnewline = (ch == '\n');
+        if (cbuf) {
+            if (ch >= 0x100)
+                ch = '?';
+            cbuf[lx] = ch;
+        }
+        else {
+            ubuf[lx] = ch;
+        }
+    }
+    if (cbuf)
+        cbuf[lx] = '\0';
+    else 
+        ubuf[lx] = '\0';
+    return lx;
+}
+
+/* Resource streams opened as unicode. We have been handed an array of
+    bytes, which are either big-endian four-byte chunks (for binary 
+    chunks) or a UTF-8 byte sequence (for text chunks). Mapped unicode
+    files are big-endian four-byte arrays too, so they use these as
+    well. Neither is ever writable, so there are no put functions. */
+
+static int resource_read(stream_t *str, glui32 *chp)
+{
+    glui32 ch, val0, val1, val2, val3;
+
+    if (str->isbinary) {
+        /* cheap big-endian stream */
+        if (str->bufptr >= str->bufend)
+            return FALSE;
+        ch = *(str->bufptr);
+        str->bufptr++;
+        if (str->bufptr >= str->bufend)
+            return FALSE;
+        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
+        str->bufptr++;
+        if (str->bufptr >= str->bufend)
+            return FALSE;
+        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
+        str->bufptr++;
+        if (str->bufptr >= str->bufend)
+            return FALSE;
+        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
+        str->bufptr++;
+        *chp = ch;
+        return TRUE;
+    }
+
+    /* slightly less cheap UTF8 stream */
+    if (str->bufptr >= str->bufend)
+        return FALSE;
+    val0 = *(str->bufptr);
+    str->bufptr++;
+    if (val0 < 0x80) {
+        *chp = val0;
+        return TRUE;
+    }
+    if (str->bufptr >= str->bufend)
+        return FALSE;
+    val1 = *(str->bufptr);
+    str->bufptr++;
+    if ((val1 & 0xC0) != 0x80)
+        return FALSE;
+    if ((val0 & 0xE0) == 0xC0) {
+        ch = (val0 & 0x1F) << 6;
+        ch |= (val1 & 0x3F);
+        *chp = ch;
+        return TRUE;
+    }
+    if (str->bufptr >= str->bufend)
+        return FALSE;
+    val2 = *(str->bufptr);
+    str->bufptr++;
+    if ((val2 & 0xC0) != 0x80)
+        return FALSE;
+    if ((val0 & 0xF0) == 0xE0) {
+        ch = (((val0 & 0xF)<<12)  & 0x0000F000);
+        ch |= (((val1 & 0x3F)<<6) & 0x00000FC0);
+        ch |= (((val2 & 0x3F))    & 0x0000003F);
+    }
+    else if ((val0 & 0xF0) == 0xF0) {
+        if (str->bufptr >= str->bufend)
+            return FALSE;
+        val3 = *(str->bufptr);
+        str->bufptr++;
+        if ((val3 & 0xC0) != 0x80)
+            return FALSE;
+        ch = (((val0 & 0x7)<<18)   & 0x1C0000);
+        ch |= (((val1 & 0x3F)<<12) & 0x03F000);
+        ch |= (((val2 & 0x3F)<<6)  & 0x000FC0);
+        ch |= (((val3 & 0x3F))     & 0x00003F);
+    }
+    else {
+        return FALSE;
+    }
+    *chp = ch;
+    return TRUE;
+}
+
+/* Copy the run of ASCII at the read position of a UTF-8 stream, up to
+    len characters (and not including a newline, if stopnl is set). The
+    character after the run, if any, is for resource_read() to decode.
+    Returns the number of characters copied. */
+static glui32 resource_copy_ascii(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len, int stopnl)
+{
+    glui32 run = str->bufend - str->bufptr;
+    
+    run = scan_ascii(str->bufptr, ((len < run) ? len : run), stopnl);
+    if (run) {
+        if (cbuf)
+            memcpy(cbuf, str->bufptr, run);
+        else
+            widen_ascii(ubuf, str->bufptr, run);
+        str->bufptr += run;
+    }
+    return run;
+}
+
+static glsi32 resource_get_char(stream_t *str, int want_unicode)
+{
+    glui32 ch;
+    
+    if (!resource_read(str, &ch))
+        return -1;
+    str->readcount++;
+    if (!want_unicode && ch >= 0x100)
+        return '?';
+    return (glsi32)ch;
+}
+
+static glui32 resource_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 count, ch;
+    
+    if (str->isbinary && ubuf) {
+        /* Whole characters can be converted in one go. A partial one
+            at the end is used up, just as resource_read() would. */
+        count = (str->bufend - str->bufptr) / 4;
+        if (count > len)
+            count = len;
+        decode_be32(ubuf, str->bufptr, count);
+        str->bufptr += 4*count;
+        if (count < len)
+            str->bufptr = str->bufend;
+        str->readcount += count;
+        return count;
+    }
+
+    count = 0;
+    while (count < len) {
+        if (!str->isbinary) {
+            count += resource_copy_ascii(str, (cbuf ? cbuf+count : NULL),
+                (ubuf ? ubuf+count : NULL), len-count, FALSE);
+            if (count >= len)
+                break;
+        }
+        if (!resource_read(str, &ch))
+            break;
+        if (cbuf) {
+            if (ch >= 0x100)
+                cbuf[count] = '?';
+            else
+                cbuf[count] = ch;
+        }
+        else {
+            ubuf[count] = ch;
+        }
+        count++;
+    }
+    str->readcount += count;
+    return count;
+}
+
+static glui32 resource_get_line(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    glui32 count, ch;
+    
+    if (len == 0)
+        return 0;
+    len -= 1; /* for the terminal null */
+    count = 0;
+    while (count < len) {
+        if (!str->isbinary) {
+            count += resource_copy_ascii(str, (cbuf ? cbuf+count : NULL),
+                (ubuf ? ubuf+count : NULL), len-count, TRUE);
+            if (count >= len)
+                break;
+        }
+        if (!resource_read(str, &ch))
+            break;
+        if (cbuf) {
+            if (ch >= 0x100)
+                cbuf[count] = '?';
+            else
+                cbuf[count] = ch;
+        }
+        else {
+            ubuf[count] = ch;
+        }
+        count++;
+        if (ch == '\n')
+            break;
+    }
+    if (cbuf)
+        cbuf[count] = '\0';
+    else
+        ubuf[count] = '\0';
+    str->readcount += count;
+    return count;
+}
+
+/* Window streams. These are never readable. */
+
+static void window_put_char(stream_t *str, glui32 ch)
+{
+    if (str->win->line_request) {
+        gli_strict_warning("put_char: window has pending line request");
+        return;
+    }
+    gli_window_put_char(str->win, ((ch >= 0x100) ? '?' : ch));
+    if (str->win->echostr)
+        gli_put_char(str->win->echostr, ch);
+}
+
+static void window_put_buffer(stream_t *str, char *buf, glui32 len)
+{
+    if (str->win->line_request) {
+        gli_strict_warning("put_buffer: window has pending line request");
+        return;
+    }
+    gli_window_put_buffer(str->win, buf, len);
+    if (str->win->echostr)
+        gli_put_buffer(str->win->echostr, buf, len);
+}
+
+static void window_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    glui32 lx;
+    
+    if (str->win->line_request) {
+        gli_strict_warning("put_buffer_uni: window has pending line request");
+        return;
+    }
+    for (lx=0; lx<len; lx++)
+        gli_window_put_char(str->win, ((buf[lx] >= 0x100) ? '?' : buf[lx]));
+    if (str->win->echostr)
+        gli_put_buffer_uni(str->win->echostr, buf, len);
+}
+
+static gli_stream_ops_t memory8_ops = {
+    memory8_put_char, memory8_put_buffer, memory8_put_buffer_uni,
+    memory8_get_char, memory8_get_buffer, memory8_get_line
+};
+
+static gli_stream_ops_t memory32_ops = {
+    memory32_put_char, memory32_put_buffer, memory32_put_buffer_uni,
+    memory32_get_char, memory32_get_buffer, memory32_get_line
+};
+
+static gli_stream_ops_t file8_ops = {
+    file8_put_char, file8_put_buffer, file8_put_buffer_uni,
+    file8_get_char, file8_get_buffer, file8_get_line
+};
+
+static gli_stream_ops_t file32_ops = {
+    file32_put_char, file32_put_buffer, file32_put_buffer_uni,
+    file32_get_char, file32_get_buffer, file32_get_line
+};
+
+static gli_stream_ops_t fileutf8_ops = {
+    fileutf8_put_char, fileutf8_put_buffer, fileutf8_put_buffer_uni,
+    fileutf8_get_char, fileutf8_get_buffer, fileutf8_get_line
+};
+
+static gli_stream_ops_t resource_ops = {
+    NULL, NULL, NULL,
+    resource_get_char, resource_get_buffer, resource_get_line
+};
+
+static gli_stream_ops_t window_ops = {
+    window_put_char, window_put_buffer, window_put_buffer_uni,
+    null_get_char, null_get_buffer, null_get_buffer
+};
+
+static void gli_put_char(stream_t *str, glui32 ch)
+{
+    if (!str || !str->writable)
+        return;
+
+    str->writecount++;
+    (*str->ops->put_char)(str, ch);
+}
+
+static void gli_put_buffer(stream_t *str, char *buf, glui32 len)
+{
+    if (!str || !str->writable)
+        return;
+
+    str->writecount += len;
+    (*str->ops->put_buffer)(str, buf, len);
+}
+
+static void gli_put_buffer_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    if (!str || !str->writable)
+        return;
+
+    str->writecount += len;
+    (*str->ops->put_buffer_uni)(str, buf, len);
+}
+
+static void gli_set_style(stream_t *str, glui32 val)
+{
+    if (!str || !str->writable)
+        return;
+
+    if (val >= style_NUMSTYLES)
+        val = 0;
     
     switch (str->type) {
-        case strtype_Resource:
-            if (len == 0)
-                return 0;
-            len -= 1; /* for the terminal null */
-            if (str->unicode) {
-                glui32 count = 0;
-                while (count < len) {
-                    glui32 ch;
-                    if (str->isbinary) {
-                        /* cheap big-endian stream */
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = *(str->bufptr);
-                        str->bufptr++;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                        str->bufptr++;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                        str->bufptr++;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        ch = (ch << 8) | (*(str->bufptr) & 0xFF);
-                        str->bufptr++;
-                    }
-                    else {
-                        /* slightly less cheap UTF8 stream */
-                        glui32 val0, val1, val2, val3;
-                        if (str->bufptr >= str->bufend)
-                            break;
-                        val0 = *(str->bufptr);
-                        str->bufptr++;
-                        if (val0 < 0x80) {
-                            ch = val0;
-                        }
-                        else {
-                            if (str->bufptr >= str->bufend)
-                                break;
-                            val1 = *(str->bufptr);
-                            str->bufptr++;
-                            if ((val1 & 0xC0) != 0x80)
-                                break;
-                            if ((val0 & 0xE0) == 0xC0) {
-                                ch = (val0 & 0x1F) << 6;
-                                ch |= (val1 & 0x3F);
-                            }
-                            else {
-                                if (str->bufptr >= str->bufend)
-                                    break;
-                                val2 = *(str->bufptr);
-                                str->bufptr++;
-                                if ((val2 & 0xC0) != 0x80)
-                                    break;
-                                if ((val0 & 0xF0) == 0xE0) {
-                                    ch = (((val0 & 0xF)<<12)  & 0x0000F000);
-                                    ch |= (((val1 & 0x3F)<<6) & 0x00000FC0);
-                                    ch |= (((val2 & 0x3F))    & 0x0000003F);
-                                }
-                                else if ((val0 & 0xF0) == 0xF0) {
-                                    if (str->bufptr >= str->bufend)
-                                        break;
-                                    val3 = *(str->bufptr);
-                                    str->bufptr++;
-                                    if ((val3 & 0xC0) != 0x80)
-                                        break;
-                                    ch = (((val0 & 0x7)<<18)   & 0x1C0000);
-                                    ch |= (((val1 & 0x3F)<<12) & 0x03F000);
-                                    ch |= (((val2 & 0x3F)<<6)  & 0x000FC0);
-                                    ch |= (((val3 & 0x3F))     & 0x00003F);
-                                }
-                                else {
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    if (cbuf) {
-                        if (ch >= 0x100)
-                            cbuf[count] = '?';
-                        else
-                            cbuf[count] = ch;
-                    }
-                    else {
-                        ubuf[count] = ch;
-                    }
-                    count++;
-                    if (ch == '\n')
-                        break;
-                }
-                if (cbuf)
-                    cbuf[count] = '\0';
-                else
-                    ubuf[count] = '\0';
-                str->readcount += count;
-                return count;
-            }
-            /* for text streams, fall through to memory case */
-        case strtype_Memory:
-            if (len == 0)
-                return 0;
-            len -= 1; /* for the terminal null */
-            if (!str->unicode) {
-                if (str->bufptr >= str->bufend) {
-                    len = 0;
-                }
-                else {
-                    if (str->bufptr + len > str->bufend) {
-                        lx = (str->bufptr + len) - str->bufend;
-                        if (lx < len)
-                            len -= lx;
-                        else
-                            len = 0;
-                    }
-                }
-                gotnewline = FALSE;
-                if (cbuf) {
-                    for (lx=0; lx<len && !gotnewline; lx++) {
-                        cbuf[lx] = str->bufptr[lx];
-                        gotnewline = (cbuf[lx] == '\n');
-                    }
-                    cbuf[lx] = '\0';
-                }
-                else {
-                    for (lx=0; lx<len && !gotnewline; lx++) {
-                        ubuf[lx] = (unsigned char)str->bufptr[lx];
-                        gotnewline = (ubuf[lx] == '\n');
-                    }
-                    ubuf[lx] = '\0';
-                }
-                str->bufptr += lx;
-            }
-            else {
-                if (str->ubufptr >= str->ubufend) {
-                    len = 0;
-                }
-                else {
-                    if (str->ubufptr + len > str->ubufend) {
-                        lx = (str->ubufptr + len) - str->ubufend;
-                        if (lx < len)
-                            len -= lx;
-                        else
-                            len = 0;
-                    }
-                }
-                gotnewline = FALSE;
-                if (cbuf) {
-                    for (lx=0; lx<len && !gotnewline; lx++) {
-                        glui32 ch;
-                        ch = str->ubufptr[lx];
-                        if (ch >= 0x100)
-                            ch = '?';
-                        cbuf[lx] = ch;
-                        gotnewline = (ch == '\n');
-                    }
-                    cbuf[lx] = '\0';
-                }
-                else {
-                    for (lx=0; lx<len && !gotnewline; lx++) {
-                        glui32 ch;
-                        ch = str->ubufptr[lx];
-                        ubuf[lx] = ch;
-                        gotnewline = (ch == '\n');
-                    }
-                    ubuf[lx] = '\0';
-                }
-                str->ubufptr += lx;
-            }
-            str->readcount += lx;
-            return lx;
-        case strtype_File: 
-            gli_stream_ensure_op(str, filemode_Read);
-            if (!str->unicode) {
-                if (cbuf) {
-                    char *res;
-                    res = fgets(cbuf, len, str->file);
-                    /* Really, if the stream was opened in text mode, we ought
-                       to do character-set conversion here. */
-                    if (!res) {
-                        return 0;
-                    }
-                    else {
-                        lx = strlen(cbuf);
-                        str->readcount += lx;
-                        return lx;
-                    }
-                }
-                else {
-                    glui32 lx;
-                    if (len == 0)
-                        return 0;
-                    len -= 1; /* for the terminal null */
-                    gotnewline = FALSE;
-                    for (lx=0; lx<len && !gotnewline; lx++) {
-                        int res;
-                        glui32 ch;
-                        res = getc(str->file);
-                        if (res == -1)
-                            break;
-                        ch = (res & 0xFF);
-                        str->readcount++;
-                        ubuf[lx] = ch;
-                        gotnewline = (ch == '\n');
-                    }
-                    ubuf[lx] = '\0';
-                    return lx;
-                }
-            }
-            else {
-                glui32 lx;
-                if (len == 0)
-                    return 0;
-                len -= 1; /* for the terminal null */
-                gotnewline = FALSE;
-                for (lx=0; lx<len && !gotnewline; lx++) {
-                    int res;
-                    glui32 ch;
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (res & 0xFF);
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (ch << 8) | (res & 0xFF);
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (ch << 8) | (res & 0xFF);
-                    res = getc(str->file);
-                    if (res == -1)
-                        break;
-                    ch = (ch << 8) | (res & 0xFF);
-                    str->readcount++;
-                    if (cbuf) {
-                        if (ch >= 0x100)
-                            ch = '?';
-                        cbuf[lx] = ch;
-                    }
-                    else {
-                        ubuf[lx] = ch;
-                    }
-                    gotnewline = (ch == '\n');
-                }
-                if (cbuf)
-                    cbuf[lx] = '\0';
-                else 
-                    ubuf[lx] = '\0';
-                return lx;
-            }
         case strtype_Window:
-        default:
-            return 0;
+            str->win->style = val;
+            if (str->win->echostr)
+                gli_set_style(str->win->echostr, val);
+            break;
     }
 }
 
+void gli_stream_echo_line(stream_t *str, char *buf, glui32 len)
+{
+    /* This is only used to echo line input to an echo stream. See
+        the line input methods in gtw_grid and gtw_buf. */
+    gli_put_buffer(str, buf, len);
+    gli_put_char(str, '\n');
+}
+
+#ifdef GLK_MODULE_UNICODE
+
+void gli_stream_echo_line_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    /* This is only used to echo line input to an echo stream. See
+        glk_select(). */
+    gli_put_buffer_uni(str, buf, len);
+    gli_put_char(str, '\n');
+}
+
+#else
+
+void gli_stream_echo_line_uni(stream_t *str, glui32 *buf, glui32 len)
+{
+    gli_strict_warning("stream_echo_line_uni: called with no Unicode line request");
+}
+
+#endif /* GLK_MODULE_UNICODE */
+
+static glsi32 gli_get_char(stream_t *str, int want_unicode)
+{
+    if (!str || !str->readable)
+        return -1;
+    
+    return (*str->ops->get_char)(str, want_unicode);
+}
+
+static glui32 gli_get_buffer(stream_t *str, char *cbuf, glui32 *ubuf,
+    glui32 len)
+{
+    if (!str || !str->readable)
+        return 0;
+    
+    return (*str->ops->get_buffer)(str, cbuf, ubuf, len);
+}
+
+static glui32 gli_get_line(stream_t *str, char *cbuf, glui32 *ubuf, 
+    glui32 len)
+{
+    if (!str || !str->readable)
+        return 0;
+    
+    return (*str->ops->get_line)(str, cbuf, ubuf, len);
+}
+
 void glk_put_char(unsigned char ch)
 {
     gli_put_char(gli_currentstr, ch);
@@ -1557,7 +2118,7 @@ void glk_put_char(unsigned char ch)
 
 void glk_put_char_stream(stream_t *str, unsigned char ch)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("put_char_stream: invalid ref");
         return;
     }
@@ -1571,7 +2132,7 @@ void glk_put_string(char *s)
 
 void glk_put_string_stream(stream_t *str, char *s)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("put_string_stream: invalid ref");
         return;
     }
@@ -1585,7 +2146,7 @@ void glk_put_buffer(char *buf, glui32 len)
 
 void glk_put_buffer_stream(stream_t *str, char *buf, glui32 len)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("put_string_stream: invalid ref");
         return;
     }
@@ -1596,74 +2157,58 @@ void glk_put_buffer_stream(stream_t *str, char *buf, glui32 len)
 
 void glk_put_char_uni(glui32 ch)
 {
-    gli_put_char_uni(gli_currentstr, ch);
+    gli_put_char(gli_currentstr, ch);
 }
 
 void glk_put_char_stream_uni(stream_t *str, glui32 ch)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("put_char_stream: invalid ref");
         return;
     }
-    gli_put_char_uni(str, ch);
+    gli_put_char(str, ch);
 }
 
 void glk_put_string_uni(glui32 *us)
 {
-    int len = 0;
-    glui32 val;
+    glui32 len = 0;
 
-    while (1) {
-        val = us[len];
-        if (!val)
-            break;
-        gli_put_char_uni(gli_currentstr, val);
+    while (us[len])
         len++;
-    }
+    gli_put_buffer_uni(gli_currentstr, us, len);
 }
 
 void glk_put_string_stream_uni(stream_t *str, glui32 *us)
 {
-    int len = 0;
-    glui32 val;
+    glui32 len = 0;
 
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("put_string_stream: invalid ref");
         return;
     }
 
-    while (1) {
-        val = us[len];
-        if (!val)
-            break;
-        gli_put_char_uni(str, val);
+    while (us[len])
         len++;
-    }
+    gli_put_buffer_uni(str, us, len);
 }
 
 void glk_put_buffer_uni(glui32 *buf, glui32 len)
 {
-    glui32 ix;
-    for (ix=0; ix<len; ix++) {
-        gli_put_char_uni(gli_currentstr, buf[ix]);
-    }
+    gli_put_buffer_uni(gli_currentstr, buf, len);
 }
 
 void glk_put_buffer_stream_uni(stream_t *str, glui32 *buf, glui32 len)
 {
-    glui32 ix;
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("put_string_stream: invalid ref");
         return;
     }
-    for (ix=0; ix<len; ix++) {
-        gli_put_char_uni(str, buf[ix]);
-    }
+    gli_put_buffer_uni(str, buf, len);
 }
 
 glsi32 glk_get_char_stream_uni(strid_t str)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("get_char_stream_uni: invalid ref");
         return -1;
     }
@@ -1672,7 +2217,7 @@ glsi32 glk_get_char_stream_uni(strid_t str)
 
 glui32 glk_get_buffer_stream_uni(strid_t str, glui32 *buf, glui32 len)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("get_buffer_stream_uni: invalid ref");
         return -1;
     }
@@ -1681,7 +2226,7 @@ glui32 glk_get_buffer_stream_uni(strid_t str, glui32 *buf, glui32 len)
 
 glui32 glk_get_line_stream_uni(strid_t str, glui32 *buf, glui32 len)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("get_line_stream_uni: invalid ref");
         return -1;
     }
@@ -1697,7 +2242,7 @@ void glk_set_style(glui32 val)
 
 void glk_set_style_stream(stream_t *str, glui32 val)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("set_style_stream: invalid ref");
         return;
     }
@@ -1706,7 +2251,7 @@ void glk_set_style_stream(stream_t *str, glui32 val)
 
 glsi32 glk_get_char_stream(stream_t *str)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("get_char_stream: invalid ref");
         return -1;
     }
@@ -1715,7 +2260,7 @@ glsi32 glk_get_char_stream(stream_t *str)
 
 glui32 glk_get_line_stream(stream_t *str, char *buf, glui32 len)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("get_line_stream: invalid ref");
         return -1;
     }
@@ -1724,7 +2269,7 @@ glui32 glk_get_line_stream(stream_t *str, char *buf, glui32 len)
 
 glui32 glk_get_buffer_stream(stream_t *str, char *buf, glui32 len)
 {
-    if (!str) {
+    if (!gli_stream_valid(str)) {
         gli_strict_warning("get_buffer_stream: invalid ref");
         return -1;
     }
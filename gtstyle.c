@@ -27,7 +27,7 @@ glui32 glk_style_distinguish(window_t *win, glui32 styl1, glui32 styl2)
 {
     chtype *styleattrs;
 
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("style_distinguish: invalid ref");
         return FALSE;
     }
@@ -60,7 +60,7 @@ glui32 glk_style_measure(window_t *win, glui32 styl, glui32 hint,
     chtype *styleattrs;
     glui32 dummy;
 
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("style_measure: invalid ref");
         return FALSE;
     }
@@ -36,15 +36,18 @@ void win_blank_rearrange(window_t *win, grect_t *box)
     dwin->owner->bbox = *box;
 }
 
+/* The box may run off the screen while a resize is settling, so this is
+    clipped to LINES and COLS. (mvaddch() does nothing off the screen.) */
 void win_blank_redraw(window_t *win)
 {
-    int jx, ix;
+    int jx, ix, bottom, right;
     window_blank_t *dwin = win->data;
 
-    for (jx=win->bbox.top; jx<win->bbox.bottom; jx++) {
-        move(jx, win->bbox.left);
-        for (ix=win->bbox.left; ix<win->bbox.right; ix++)
-            addch(':');
+    bottom = (win->bbox.bottom < LINES) ? win->bbox.bottom : LINES;
+    right = (win->bbox.right < COLS) ? win->bbox.right : COLS;
+    for (jx=win->bbox.top; jx<bottom; jx++) {
+        for (ix=win->bbox.left; ix<right; ix++)
+            mvaddch(jx, ix, ':');
     }
     
     mvaddch(win->bbox.top, win->bbox.left, '/');
@@ -13,21 +13,68 @@
 #include "glkterm.h"
 #include "gtw_buf.h"
 
+#if defined(OPT_SSE2_LAYOUT) && defined(__SSE2__) && defined(__GNUC__)
+#define USE_SSE2_LAYOUT
+#include <emmintrin.h>
+#endif /* OPT_SSE2_LAYOUT */
+
 /* Array of curses.h attribute values, one for each style. */
 chtype win_textbuffer_styleattrs[style_NUMSTYLES];
 
-/* Maximum buffer size. The slack value is how much larger than the size 
-    we should get before we trim. */
-#define BUFFER_SIZE (5000)
-#define BUFFER_SLACK (1000)
+/* The buffer size is pref_scrollback (the -scrollback option). The slack
+    value is how much larger than the size we should get before we trim.
+    It grows with the scrollback, so that a trim (which has to slide the
+    remaining text, lines, and runs down) happens once per quarter-buffer
+    of output rather than on every turn. */
+#define BUFFER_SLACK_MIN (1000)
+#define BUFFER_SLACK(size) \
+    (((size) / 4 > BUFFER_SLACK_MIN) ? ((size) / 4) : BUFFER_SLACK_MIN)
 
 static void final_lines(window_textbuffer_t *dwin, long beg, long end);
+static long alloc_words(window_textbuffer_t *dwin, long count, 
+    long numtmplines);
 static long find_style_by_pos(window_textbuffer_t *dwin, long pos);
 static long find_line_by_pos(window_textbuffer_t *dwin, long pos);
 static void set_last_run(window_textbuffer_t *dwin, glui32 style);
+static void pad_setup(window_textbuffer_t *dwin);
+static void pad_forget(window_textbuffer_t *dwin, long beg, long end);
+static int pad_row(window_textbuffer_t *dwin, long lx);
+static void draw_lines(window_textbuffer_t *dwin);
+static int draw_line_fast(window_textbuffer_t *dwin, tbline_t *ln, int row);
+static void draw_line_slow(window_textbuffer_t *dwin, tbline_t *ln, int row);
+static long relayout_stale(window_textbuffer_t *dwin, long lx);
+static long layout_text(window_textbuffer_t *dwin, long chbeg, long chend,
+    int startpara);
+static tbcache_t *cache_find(window_textbuffer_t *dwin, long pos, long len);
+static void cache_store(window_textbuffer_t *dwin, long pos, long len,
+    long lxbeg, long lxend);
+static void cache_discard(window_textbuffer_t *dwin, long beg, long end);
 static void import_input_line(window_textbuffer_t *dwin, void *buf, 
     int unicode, long len);
 static void export_input_line(void *buf, int unicode, long len, char *chars);
+static void history_add(window_textbuffer_t *dwin, char *cx);
+static void search_index_update(window_textbuffer_t *dwin);
+
+/* A row of characters-with-attributes, which updatetext() composes each
+    line into before handing it to curses. Shared by all buffer windows. */
+static chtype *drawrow = NULL;
+static int drawrowsize = 0;
+
+/* How many cells curses draws each character as. (waddch() expands some
+    into things like "~N", so lines containing them have to be drawn the
+    slow way.) */
+static char drawcell_table[256];
+static int drawcell_init = FALSE;
+
+/* The pad holds the visible lines, plus about as many more as the
+    scrollback can fill at the window's width, up to this limit. */
+#define PAD_MAX_ROWS (1000)
+
+/* The padline[] value of a row which holds no line. */
+#define PAD_NOLINE (-0x7FFFFFFFL)
+
+/* Number of hash buckets in each window's layout cache. */
+#define CACHE_HASH_SIZE (256)
 
 window_textbuffer_t *win_textbuffer_create(window_t *win)
 {
@@ -53,8 +100,26 @@ window_textbuffer_t *win_textbuffer_create(window_t *win)
     dwin->tmpwordssize = 40;
     dwin->tmpwords = (tbword_t *)malloc(dwin->tmpwordssize * sizeof(tbword_t));
     
+    dwin->numarena = 0;
+    dwin->arenalive = 0;
+    dwin->arenasize = 400;
+    dwin->arena = (tbpword_t *)malloc(dwin->arenasize * sizeof(tbpword_t));
+    
+    dwin->cachehash = NULL;
+    dwin->cachefirst = NULL;
+    dwin->cachelast = NULL;
+    dwin->cachesize = 0;
+    dwin->cacheend = 0;
+    dwin->trimmed = 0;
+    
+    dwin->searchbits = NULL;
+    dwin->searchblocks = 0;
+    dwin->searchsize = 0;
+    dwin->searchfirst = 0;
+    dwin->searchpos = -1;
+    
     if (!dwin->chars || !dwin->runs || !dwin->lines 
-        || !dwin->tmplines || !dwin->tmpwords)
+        || !dwin->tmplines || !dwin->tmpwords || !dwin->arena)
         return NULL;
 
     dwin->inbuf = NULL;
@@ -87,6 +152,14 @@ window_textbuffer_t *win_textbuffer_create(window_t *win)
     dwin->scrollpos = 0;
     dwin->lastseenline = 0;
     dwin->drawall = TRUE;
+    dwin->shownline = -1;
+    dwin->stalepos = 0;
+    
+    dwin->pad = NULL;
+    dwin->padrows = 0;
+    dwin->padline = NULL;
+    dwin->linebase = 0;
+    dwin->padmoved = FALSE;
     
     dwin->width = -1;
     dwin->height = -1;
@@ -118,6 +191,27 @@ void win_textbuffer_destroy(window_textbuffer_t *dwin)
         dwin->lines = NULL;
     }
     
+    if (dwin->arena) {
+        free(dwin->arena);
+        dwin->arena = NULL;
+    }
+    
+    if (dwin->tmpwords) {
+        free(dwin->tmpwords);
+        dwin->tmpwords = NULL;
+    }
+    
+    if (dwin->cachehash) {
+        cache_discard(dwin, 0, dwin->cacheend);
+        free(dwin->cachehash);
+        dwin->cachehash = NULL;
+    }
+    
+    if (dwin->searchbits) {
+        free(dwin->searchbits);
+        dwin->searchbits = NULL;
+    }
+    
     if (dwin->runs) {
         free(dwin->runs);
         dwin->runs = NULL;
@@ -128,6 +222,16 @@ void win_textbuffer_destroy(window_textbuffer_t *dwin)
         dwin->chars = NULL;
     }
     
+    if (dwin->pad) {
+        delwin(dwin->pad);
+        dwin->pad = NULL;
+    }
+    
+    if (dwin->padline) {
+        free(dwin->padline);
+        dwin->padline = NULL;
+    }
+    
     free(dwin);
 }
 
@@ -137,11 +241,67 @@ static void final_lines(window_textbuffer_t *dwin, long beg, long end)
     
     for (lx=beg; lx<end; lx++) {
         tbline_t *ln = &(dwin->lines[lx]);
-        if (ln->words) {
-            free(ln->words);
-            ln->words = NULL;
+        if (ln->words != -1) {
+            /* The slice becomes garbage; alloc_words() will reclaim it. */
+            dwin->arenalive -= ln->numwords;
+            ln->words = -1;
+            ln->numwords = 0;
+        }
+    }
+}
+
+/* Copy the live slices of a set of lines into a new arena, in order. */
+static long copy_line_words(tbline_t *lines, long numlines, 
+    tbpword_t *oldarena, tbpword_t *newarena, long newpos)
+{
+    long lx;
+    
+    for (lx=0; lx<numlines; lx++) {
+        tbline_t *ln = &(lines[lx]);
+        if (ln->words != -1) {
+            memcpy(newarena+newpos, oldarena+ln->words, 
+                ln->numwords * sizeof(tbpword_t));
+            ln->words = newpos;
+            newpos += ln->numwords;
+        }
+    }
+    
+    return newpos;
+}
+
+/* Reserve count words at the end of the word arena, and return the index
+    of the first. If the arena is full and at least half of it is garbage,
+    compact it rather than growing it. During layout, the first numtmplines
+    tmplines also own slices, so they are carried along. */
+static long alloc_words(window_textbuffer_t *dwin, long count, 
+    long numtmplines)
+{
+    long pos;
+    
+    if (dwin->numarena + count > dwin->arenasize) {
+        if (dwin->numarena - dwin->arenalive >= dwin->arenalive) {
+            tbpword_t *newarena = (tbpword_t *)malloc(dwin->arenasize 
+                * sizeof(tbpword_t));
+            pos = copy_line_words(dwin->lines, dwin->numlines, 
+                dwin->arena, newarena, 0);
+            pos = copy_line_words(dwin->tmplines, numtmplines, 
+                dwin->arena, newarena, pos);
+            free(dwin->arena);
+            dwin->arena = newarena;
+            dwin->numarena = pos;
+        }
+        if (dwin->numarena + count > dwin->arenasize) {
+            while (dwin->numarena + count > dwin->arenasize)
+                dwin->arenasize *= 2;
+            dwin->arena = (tbpword_t *)realloc(dwin->arena, 
+                dwin->arenasize * sizeof(tbpword_t));
         }
     }
+    
+    pos = dwin->numarena;
+    dwin->numarena += count;
+    dwin->arenalive += count;
+    return pos;
 }
 
 void win_textbuffer_rearrange(window_t *win, grect_t *box)
@@ -155,17 +315,45 @@ void win_textbuffer_rearrange(window_t *win, grect_t *box)
 
     dwin->width = box->right - box->left;
     dwin->height = box->bottom - box->top;
+    dwin->shownline = -1;
+    
+    /* The pad is made afresh even if the size hasn't changed, since the
+        curses screen may have been replaced. */
+    pad_setup(dwin);
     
     if (oldwid != dwin->width) {
-        /* Set dirty region to the whole (or visible?), and
-            delta should indicate that the whole old region is changed. */
+        long lx, lx2;
+        long parapos = 0;
+        
+        /* Only lay out the text from the paragraph at the top of the 
+            window (or the one containing the dirty region, if that's 
+            earlier) to the end. Everything before that is left stale, and
+            laid out when it's scrolled into view. */
+        if (dwin->numlines > 0) {
+            lx = dwin->scrollline;
+            if (lx >= dwin->numlines)
+                lx = dwin->numlines - 1;
+            if (dwin->dirtybeg != -1) {
+                lx2 = find_line_by_pos(dwin, dwin->dirtybeg);
+                if (lx2 < lx)
+                    lx = lx2;
+            }
+            while (lx > 0 && !dwin->lines[lx].startpara)
+                lx--;
+            if (lx > 0)
+                parapos = dwin->lines[lx].pos;
+        }
+        dwin->stalepos = parapos;
+        
+        /* Set dirty region to the rest of the text, and delta should 
+            indicate that the whole old region is changed. */
         if (dwin->dirtybeg == -1) {
-            dwin->dirtybeg = 0;
+            dwin->dirtybeg = parapos;
             dwin->dirtyend = dwin->numchars;
             dwin->dirtydelta = 0;
         }
         else {
-            dwin->dirtybeg = 0;
+            dwin->dirtybeg = parapos;
             dwin->dirtyend = dwin->numchars;
         }
     }
@@ -173,22 +361,36 @@ void win_textbuffer_rearrange(window_t *win, grect_t *box)
     }
 }
 
-/* Find the last line for which pos >= line.pos. If pos is before the first 
+/* Find the last line for which pos >= line.pos. If pos is before the first
     line.pos, or if there are no lines, this returns -1. Lines always go to
     the end of the text, so this will never be numlines or higher. */
 static long find_line_by_pos(window_textbuffer_t *dwin, long pos)
 {
-    long lx;
-    
-    if (dwin->numlines == 0)
+    long beg, end, val;
+    tbline_t *lines = dwin->lines;
+
+    if (dwin->numlines == 0 || pos < lines[0].pos)
         return -1;
-    
-    for (lx=dwin->numlines-1; lx >= 0; lx--) {
-        if (pos >= dwin->lines[lx].pos)
-            return lx;
+
+    /* The line positions are nondecreasing, so we can do a binary search,
+        maintaining
+            lines[beg].pos <= pos < lines[end].pos
+        (we pretend that lines[numlines].pos is infinity) */
+
+    beg = 0;
+    end = dwin->numlines;
+
+    while (beg+1 < end) {
+        val = (beg+end) / 2;
+        if (pos >= lines[val].pos) {
+            beg = val;
+        }
+        else {
+            end = val;
+        }
     }
-    
-    return -1;
+
+    return beg;
 }
 
 /* Find the last stylerun for which pos >= style.pos. We know run[0].pos == 0,
@@ -218,13 +420,62 @@ static long find_style_by_pos(window_textbuffer_t *dwin, long pos)
     return beg;
 }
 
-/* This does layout on a segment of text, writing into tmplines. Returns
-    the number of lines laid. Assumes tmplines is entirely unused, 
-    initially. */
-static long layout_chars(window_textbuffer_t *dwin, long chbeg, long chend,
-    int startpara)
+/* Return the first position in [cx, end) which holds a space or a newline,
+    or end if there is none. */
+static long scan_text_word(char *chars, long cx, long end)
+{
+#ifdef USE_SSE2_LAYOUT
+    __m128i spaces = _mm_set1_epi8(' ');
+    __m128i newlines = _mm_set1_epi8('\n');
+    __m128i block;
+    int mask;
+    
+    while (cx + 16 <= end) {
+        block = _mm_loadu_si128((__m128i *)(chars+cx));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, spaces),
+            _mm_cmpeq_epi8(block, newlines)));
+        if (mask)
+            return cx + __builtin_ctz(mask);
+        cx += 16;
+    }
+#endif /* USE_SSE2_LAYOUT */
+    
+    while (cx < end && chars[cx] != '\n' && chars[cx] != ' ')
+        cx++;
+    return cx;
+}
+
+/* Return the first position in [cx, end) which does not hold a space, or
+    end if there is none. */
+static long scan_blanks(char *chars, long cx, long end)
+{
+#ifdef USE_SSE2_LAYOUT
+    __m128i spaces = _mm_set1_epi8(' ');
+    __m128i block;
+    int mask;
+    
+    while (cx + 16 <= end) {
+        block = _mm_loadu_si128((__m128i *)(chars+cx));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, spaces)) ^ 0xFFFF;
+        if (mask)
+            return cx + __builtin_ctz(mask);
+        cx += 16;
+    }
+#endif /* USE_SSE2_LAYOUT */
+    
+    while (cx < end && chars[cx] == ' ')
+        cx++;
+    return cx;
+}
+
+/* This does layout on a segment of text, writing into tmplines starting
+    at index lxbeg. Returns the number of tmplines in use afterwards. Assumes
+    tmplines from lxbeg on is unused, initially. */
+static long layout_chars(window_textbuffer_t *dwin, long lxbeg, long chbeg,
+    long chend, int startpara)
 {
     long cx, cx2, lx, rx;
+    long wordend;
     long numwords; 
     long linestartpos;
     char ch;
@@ -238,7 +489,7 @@ static long layout_chars(window_textbuffer_t *dwin, long chbeg, long chend,
     lastlinetype = (startpara) ? wd_EndLine : wd_Text;
     cx = chbeg;
     linestartpos = chbeg;
-    lx = 0;
+    lx = lxbeg;
     numwords = 0; /* actually number of tmpwords */
     
     rx = find_style_by_pos(dwin, chbeg);
@@ -304,19 +555,18 @@ static long layout_chars(window_textbuffer_t *dwin, long chbeg, long chend,
                 else if (ch == ' ') {
                     wd->type = wd_Blank;
                     wd->pos = cx2;
-                    while (cx < chend 
-                            && cx < styleendpos && chars[cx] == ' ')
-                        cx++;
+                    wordend = (chend < styleendpos) ? chend : styleendpos;
+                    if (wordend > cx2 + MAX_WORD_LEN)
+                        wordend = cx2 + MAX_WORD_LEN;
+                    cx = scan_blanks(chars, cx, wordend);
                     wd->len = cx - (wd->pos);
                     wd->style = style;
                 }
                 else {
                     wd->type = wd_Text;
                     wd->pos = cx2;
-                    while (cx < chend 
-                            && cx < styleendpos && chars[cx] != '\n' 
-                            && chars[cx] != ' ')
-                        cx++;
+                    wordend = (chend < styleendpos) ? chend : styleendpos;
+                    cx = scan_text_word(chars, cx, wordend);
                     wd->len = cx - (wd->pos);
                     wd->style = style;
                 }
@@ -410,9 +660,18 @@ static long layout_chars(window_textbuffer_t *dwin, long chbeg, long chend,
         }
         
         if (lineeatto) {
-            ln->words = (tbword_t *)malloc(lineeatto * sizeof(tbword_t));
-            memcpy(ln->words, dwin->tmpwords, lineeatto * sizeof(tbword_t));
+            tbpword_t *pwd;
+            ln->words = alloc_words(dwin, lineeatto, lx-1);
             ln->numwords = lineeatto;
+            /* Stored word positions are relative to the line start. */
+            pwd = &(dwin->arena[ln->words]);
+            for (wx2=0; wx2<lineeatto; wx2++, pwd++) {
+                tbword_t *wd2 = &(dwin->tmpwords[wx2]);
+                pwd->pos = wd2->pos - linestartpos;
+                pwd->len = wd2->len;
+                pwd->type = wd2->type;
+                pwd->style = wd2->style;
+            }
             
             if (lineeatto < numwords) {
                 memmove(dwin->tmpwords, 
@@ -422,14 +681,14 @@ static long layout_chars(window_textbuffer_t *dwin, long chbeg, long chend,
             numwords -= lineeatto;
         }
         else {
-            ln->words = NULL;
+            ln->words = -1;
             ln->numwords = 0;
         }
         ln->pos = linestartpos;
         ln->len = 0;
         ln->printwords = 0;
         for (wx2=0; wx2<ln->numwords; wx2++) {
-            tbword_t *wd2 = &(ln->words[wx2]);
+            tbpword_t *wd2 = &(dwin->arena[ln->words+wx2]);
             ln->len += wd2->len;
             if (wd2->type != wd_EndLine && ln->len <= linewidth)
                 ln->printwords = wx2+1;
@@ -445,6 +704,231 @@ static long layout_chars(window_textbuffer_t *dwin, long chbeg, long chend,
     return lx;
 }
 
+/* Copy a cached paragraph into tmplines at index lx, for text starting at
+    pos. Returns the number of tmplines in use afterwards. */
+static long cache_copy(window_textbuffer_t *dwin, tbcache_t *ent, long lx,
+    long pos)
+{
+    long ix;
+    tbline_t *ln;
+    
+    for (ix=0; ix<ent->numlines; ix++) {
+        if (lx+2 >= dwin->tmplinessize) {
+            dwin->tmplinessize *= 2;
+            dwin->tmplines = (tbline_t *)realloc(dwin->tmplines, 
+                dwin->tmplinessize * sizeof(tbline_t));
+        }
+        ln = &(dwin->tmplines[lx]);
+        *ln = ent->lines[ix];
+        ln->pos += pos;
+        if (ln->numwords) {
+            ln->words = alloc_words(dwin, ln->numwords, lx);
+            memcpy(&(dwin->arena[ln->words]), 
+                &(ent->words[ent->lines[ix].words]), 
+                ln->numwords * sizeof(tbpword_t));
+        }
+        lx++;
+    }
+    
+    return lx;
+}
+
+/* This does layout on a segment of text, writing into tmplines, just as
+    layout_chars() does. But each complete paragraph is taken from the
+    layout cache, if it's there, and put there if it's not. Returns the
+    number of lines laid. */
+static long layout_text(window_textbuffer_t *dwin, long chbeg, long chend,
+    int startpara)
+{
+    long lx, lx2;
+    long pbeg, pend;
+    char *nl;
+    tbcache_t *ent;
+    
+    if (pref_layoutcache <= 0)
+        return layout_chars(dwin, 0, chbeg, chend, startpara);
+    
+    lx = 0;
+    pbeg = chbeg;
+    
+    while (pbeg < chend) {
+        nl = memchr(dwin->chars+pbeg, '\n', chend-pbeg);
+        if (!nl)
+            break;
+        pend = (nl - dwin->chars) + 1;
+        
+        /* A paragraph which begins partway through (after a trim) can't
+            be cached, since its first line isn't the start of a 
+            paragraph. */
+        ent = NULL;
+        if (startpara)
+            ent = cache_find(dwin, pbeg, pend-pbeg);
+        if (ent) {
+            lx = cache_copy(dwin, ent, lx, pbeg);
+        }
+        else {
+            /* Lay out through the newline, and drop the empty line which
+                layout_chars() adds after it; the next paragraph starts
+                there. */
+            lx2 = layout_chars(dwin, lx, pbeg, pend, startpara) - 1;
+            if (startpara)
+                cache_store(dwin, pbeg, pend-pbeg, lx, lx2);
+            lx = lx2;
+        }
+        
+        pbeg = pend;
+        startpara = TRUE;
+    }
+    
+    /* The rest has no newline, so it may still grow. Don't cache it. */
+    return layout_chars(dwin, lx, pbeg, chend, startpara);
+}
+
+static int cache_hash(long pos, int width)
+{
+    return (int)((unsigned long)(pos * 31 + width) % CACHE_HASH_SIZE);
+}
+
+static void cache_remove(window_textbuffer_t *dwin, tbcache_t *ent)
+{
+    tbcache_t **pent;
+    
+    for (pent = &(dwin->cachehash[cache_hash(ent->pos, ent->width)]);
+        *pent != ent;
+        pent = &((*pent)->chain)) { }
+    *pent = ent->chain;
+    
+    if (ent->prev)
+        ent->prev->next = ent->next;
+    else
+        dwin->cachefirst = ent->next;
+    if (ent->next)
+        ent->next->prev = ent->prev;
+    else
+        dwin->cachelast = ent->prev;
+    
+    dwin->cachesize -= ent->size;
+    free(ent);
+}
+
+/* Find the cached layout of the paragraph at pos, at the current width.
+    Returns NULL if there isn't one. */
+static tbcache_t *cache_find(window_textbuffer_t *dwin, long pos, long len)
+{
+    tbcache_t *ent;
+    
+    if (!dwin->cachehash)
+        return NULL;
+    
+    pos += dwin->trimmed;
+    for (ent = dwin->cachehash[cache_hash(pos, dwin->width)];
+        ent;
+        ent = ent->chain) {
+        if (ent->pos == pos && ent->len == len 
+            && ent->width == dwin->width)
+            break;
+    }
+    
+    if (ent && ent->prev) {
+        /* move it to the front of the list */
+        ent->prev->next = ent->next;
+        if (ent->next)
+            ent->next->prev = ent->prev;
+        else
+            dwin->cachelast = ent->prev;
+        ent->prev = NULL;
+        ent->next = dwin->cachefirst;
+        dwin->cachefirst->prev = ent;
+        dwin->cachefirst = ent;
+    }
+    
+    return ent;
+}
+
+/* Cache tmplines[lxbeg, lxend), which are the layout of the paragraph at 
+    pos. The least recently used paragraphs are thrown out to make room. */
+static void cache_store(window_textbuffer_t *dwin, long pos, long len,
+    long lxbeg, long lxend)
+{
+    long lx, ix, wx;
+    long numwords, size;
+    long budget = (long)pref_layoutcache * 1024;
+    tbcache_t *ent;
+    tbline_t *ln;
+    int hx;
+    
+    numwords = 0;
+    for (lx=lxbeg; lx<lxend; lx++)
+        numwords += dwin->tmplines[lx].numwords;
+    size = sizeof(tbcache_t) + (lxend-lxbeg) * sizeof(tbline_t)
+        + numwords * sizeof(tbpword_t);
+    if (size > budget)
+        return;
+    
+    if (!dwin->cachehash) {
+        dwin->cachehash = (tbcache_t **)calloc(CACHE_HASH_SIZE, 
+            sizeof(tbcache_t *));
+        if (!dwin->cachehash)
+            return;
+    }
+    
+    while (dwin->cachelast && dwin->cachesize + size > budget)
+        cache_remove(dwin, dwin->cachelast);
+    
+    ent = (tbcache_t *)malloc(size);
+    if (!ent)
+        return;
+    ent->pos = dwin->trimmed + pos;
+    ent->len = len;
+    ent->width = dwin->width;
+    ent->numlines = lxend-lxbeg;
+    ent->lines = (tbline_t *)(ent+1);
+    ent->words = (tbpword_t *)(ent->lines + ent->numlines);
+    ent->size = size;
+    
+    wx = 0;
+    for (ix=0; ix<ent->numlines; ix++) {
+        ln = &(ent->lines[ix]);
+        *ln = dwin->tmplines[lxbeg+ix];
+        ln->pos -= pos;
+        if (ln->numwords) {
+            memcpy(&(ent->words[wx]), &(dwin->arena[ln->words]), 
+                ln->numwords * sizeof(tbpword_t));
+            ln->words = wx;
+            wx += ln->numwords;
+        }
+    }
+    
+    hx = cache_hash(ent->pos, ent->width);
+    ent->chain = dwin->cachehash[hx];
+    dwin->cachehash[hx] = ent;
+    
+    ent->prev = NULL;
+    ent->next = dwin->cachefirst;
+    if (dwin->cachefirst)
+        dwin->cachefirst->prev = ent;
+    else
+        dwin->cachelast = ent;
+    dwin->cachefirst = ent;
+    
+    dwin->cachesize += size;
+    if (ent->pos + len > dwin->cacheend)
+        dwin->cacheend = ent->pos + len;
+}
+
+/* Throw out the cached paragraphs which overlap [beg, end). (These
+    positions include the trimmed count, like the cached ones.) */
+static void cache_discard(window_textbuffer_t *dwin, long beg, long end)
+{
+    tbcache_t *ent, *next;
+    
+    for (ent = dwin->cachefirst; ent; ent = next) {
+        next = ent->next;
+        if (ent->pos < end && ent->pos + ent->len > beg)
+            cache_remove(dwin, ent);
+    }
+}
+
 /* Replace lines[oldbeg, oldend) with tmplines[0, newnum). The replaced lines
     are deleted; the tmplines array winds up invalid (so it will not need to
     be deleted.) */
@@ -490,6 +974,14 @@ static void replace_lines(window_textbuffer_t *dwin, long oldbeg, long oldend,
         /* leave scrollline alone */
     }
 
+    if (dwin->shownline >= oldend) {
+        dwin->shownline += diff;
+    }
+    else if (dwin->shownline >= oldbeg) {
+        /* the top line on screen went away */
+        dwin->shownline = -1;
+    }
+
     if (dwin->lastseenline > oldend) {
         dwin->lastseenline += diff;
     }
@@ -506,6 +998,58 @@ static void replace_lines(window_textbuffer_t *dwin, long oldbeg, long oldend,
         dwin->scrollline = 0;
 }
 
+/* Lay out stale lines, working back from the end of the stale region, 
+    until line lx is up to date. The number of lines between lx and the end 
+    of the stale region is preserved, as far as possible (except that line
+    zero stays line zero). Returns the new index of line lx. 
+   Every line after the relayout may have a new index, so this forgets
+    the whole pad. */
+static long relayout_stale(window_textbuffer_t *dwin, long lx)
+{
+    long fresh, lnbeg, numtmplines, seenpos;
+    int totop = (lx <= 0);
+    
+    while (dwin->stalepos > 0) {
+        fresh = find_line_by_pos(dwin, dwin->stalepos);
+        if (lx >= fresh)
+            break;
+        
+        /* back up to the start of a paragraph */
+        lnbeg = lx;
+        if (lnbeg < 0)
+            lnbeg = 0;
+        while (lnbeg > 0 && !dwin->lines[lnbeg].startpara)
+            lnbeg--;
+        
+        /* The stale region ends just after a newline. Lay out through
+            the newline, and drop the empty line which layout_text() adds
+            after it; that position already starts an up-to-date line. */
+        numtmplines = layout_text(dwin, dwin->lines[lnbeg].pos, 
+            dwin->stalepos, dwin->lines[lnbeg].startpara);
+        numtmplines--;
+        /* The text hasn't changed, so the last-seen line keeps its
+            position rather than snapping to lnbeg. */
+        if (dwin->lastseenline >= 0 && dwin->lastseenline < dwin->numlines)
+            seenpos = dwin->lines[dwin->lastseenline].pos;
+        else
+            seenpos = -1;
+        replace_lines(dwin, lnbeg, fresh, numtmplines);
+        if (seenpos >= 0)
+            dwin->lastseenline = find_line_by_pos(dwin, seenpos);
+        dwin->drawall = TRUE;
+        
+        lx = (lnbeg + numtmplines) - (fresh - lx);
+        if (lnbeg > 0)
+            dwin->stalepos = dwin->lines[lnbeg].pos;
+        else
+            dwin->stalepos = 0;
+    }
+    
+    if (lx < 0 || totop)
+        lx = 0;
+    return lx;
+}
+
 static void updatetext(window_textbuffer_t *dwin)
 {
     long drawbeg, drawend;
@@ -552,7 +1096,7 @@ static void updatetext(window_textbuffer_t *dwin)
         /* lnend is now the first line not to replace. [0..numlines]
             lnbeg is the first line *to* replace [0..numlines) */
         
-        numtmplines = layout_chars(dwin, chbeg, chend, startpara);
+        numtmplines = layout_text(dwin, chbeg, chend, startpara);
         dwin->dirtybeg = -1;
         dwin->dirtyend = -1;
         dwin->dirtydelta = -1;
@@ -576,53 +1120,303 @@ static void updatetext(window_textbuffer_t *dwin)
         drawend = 0;
     }
     
+    if (dwin->stalepos > 0 
+        && dwin->scrollline < find_line_by_pos(dwin, dwin->stalepos)) {
+        /* The window has been scrolled back into stale lines. */
+        dwin->scrollline = relayout_stale(dwin, dwin->scrollline);
+        if (dwin->scrollline > dwin->numlines - dwin->height)
+            dwin->scrollline = dwin->numlines - dwin->height;
+        if (dwin->scrollline < 0)
+            dwin->scrollline = 0;
+        if (dwin->scrollline >= dwin->numlines)
+            dwin->scrollpos = dwin->numchars;
+        else
+            dwin->scrollpos = dwin->lines[dwin->scrollline].pos;
+        dwin->drawall = TRUE;
+    }
+    
     if (dwin->drawall) {
-        drawbeg = dwin->scrollline;
-        drawend = dwin->scrollline + dwin->height;
+        pad_forget(dwin, 0, -1);
         dwin->drawall = FALSE;
     }
+    else if (drawend > drawbeg) {
+        pad_forget(dwin, drawbeg, drawend);
+    }
     
-    if (drawend > drawbeg) {
-        long lx, wx;
-        int ix;
-        int physln;
-        int orgx, orgy;
-        
-        if (drawbeg < dwin->scrollline)
-            drawbeg = dwin->scrollline;
-        if (drawend > dwin->scrollline + dwin->height)
-            drawend = dwin->scrollline + dwin->height;
+    if (dwin->shownline != dwin->scrollline) {
+        /* The window has been scrolled. Lines which are still in the pad
+            don't need drawing again; the new viewport is copied to the
+            screen at the next flush, and curses works out whether the
+            terminal can scroll them there. */
+        window_t *win = dwin->owner;
+        dwin->padmoved = TRUE;
+        gli_damage_rect(win->bbox.left, win->bbox.top, 
+            win->bbox.right, win->bbox.bottom);
+    }
+    dwin->shownline = dwin->scrollline;
+    
+    draw_lines(dwin);
+}
+
+/* Create the pad for the window's current size. Everything in it has to
+    be drawn again. */
+static void pad_setup(window_textbuffer_t *dwin)
+{
+    int rows, ix;
+    long *padline;
+    
+    if (dwin->pad) {
+        delwin(dwin->pad);
+        dwin->pad = NULL;
+    }
+    dwin->padrows = 0;
+    
+    if (dwin->width <= 0 || dwin->height <= 0)
+        return;
+    
+    rows = dwin->height + pref_scrollback / dwin->width;
+    if (rows > PAD_MAX_ROWS)
+        rows = PAD_MAX_ROWS;
+    if (rows < dwin->height)
+        rows = dwin->height;
+    
+    padline = (long *)realloc(dwin->padline, rows * sizeof(long));
+    if (!padline)
+        return;
+    dwin->padline = padline;
+    
+    dwin->pad = newpad(rows, dwin->width);
+    if (!dwin->pad)
+        return;
+    leaveok(dwin->pad, TRUE);
+    idlok(dwin->pad, pref_hardware_scroll);
+    gli_count_curses(3);
+    
+    dwin->padrows = rows;
+    for (ix=0; ix<rows; ix++)
+        dwin->padline[ix] = PAD_NOLINE;
+    dwin->padmoved = TRUE;
+}
+
+/* Forget the pad rows holding lines [beg, end), so that they're drawn 
+    again if they're visible. If end is negative, forget every row. */
+static void pad_forget(window_textbuffer_t *dwin, long beg, long end)
+{
+    int ix;
+    long lbeg = dwin->linebase + beg;
+    long lend = dwin->linebase + end;
+    
+    for (ix=0; ix<dwin->padrows; ix++) {
+        if (end < 0 
+            || (dwin->padline[ix] >= lbeg && dwin->padline[ix] < lend))
+            dwin->padline[ix] = PAD_NOLINE;
+    }
+}
+
+/* The pad row which line lx is drawn in. (The paging code can scroll
+    to line -1, so lx may be negative.) */
+static int pad_row(window_textbuffer_t *dwin, long lx)
+{
+    long row = (dwin->linebase + lx) % dwin->padrows;
+    if (row < 0)
+        row += dwin->padrows;
+    return (int)row;
+}
+
+/* Draw the visible lines which aren't already in the pad. */
+static void draw_lines(window_textbuffer_t *dwin)
+{
+    long lx, linenum;
+    int ix, physln, row;
+    int drawtop, drawbottom;
+    window_t *win = dwin->owner;
+    
+    if (!dwin->pad)
+        return;
+    
+    if (drawrowsize < dwin->width) {
+        drawrowsize = dwin->width;
+        drawrow = (chtype *)realloc(drawrow, drawrowsize * sizeof(chtype));
+    }
+    if (!drawcell_init) {
+        for (ix=0; ix<256; ix++) {
+            const char *str = unctrl((chtype)ix);
+            if (!str)
+                drawcell_table[ix] = 0;
+            else if ((unsigned char)str[0] == ix && str[1] == '\0')
+                drawcell_table[ix] = 1;
+            else
+                drawcell_table[ix] = strlen(str);
+        }
+        drawcell_init = TRUE;
+    }
+    
+    drawtop = -1;
+    drawbottom = -1;
+    
+    for (physln=0; physln<dwin->height; physln++) {
+        lx = dwin->scrollline + physln;
+        linenum = dwin->linebase + lx;
+        row = pad_row(dwin, lx);
+        if (dwin->padline[row] == linenum)
+            continue;
+        dwin->padline[row] = linenum;
         
-        orgx = dwin->owner->bbox.left;
-        orgy = dwin->owner->bbox.top;
+        if (drawtop == -1)
+            drawtop = physln;
+        drawbottom = physln+1;
         
-        for (lx=drawbeg; lx<drawend; lx++) {
-            physln = lx - dwin->scrollline;
-            if (lx >= 0 && lx < dwin->numlines) {
-                tbline_t *ln = &(dwin->lines[lx]);
-                int count = 0;
-                move(orgy+physln, orgx);
-                for (wx=0; wx<ln->printwords; wx++) {
-                    tbword_t *wd = &(ln->words[wx]);
-                    if (wd->type == wd_Text || wd->type == wd_Blank) {
-                        unsigned char *cx = (unsigned char *)&(dwin->chars[wd->pos]);
-                        /* unsigned, so that addch() doesn't get fed any high
-                            style bits. */
-                        attrset(win_textbuffer_styleattrs[wd->style]);
-                        for (ix=0; ix<wd->len; ix++, cx++, count++)
-                            addch(*cx);
-                    }
-                }
-                attrset(0);
-                gli_print_spaces(dwin->width - count);
+        if (lx >= 0 && lx < dwin->numlines) {
+            tbline_t *ln = &(dwin->lines[lx]);
+            if (!draw_line_fast(dwin, ln, row))
+                draw_line_slow(dwin, ln, row);
+        }
+        else {
+            /* blank lines at bottom (or top) */
+            wmove(dwin->pad, row, 0);
+            wclrtoeol(dwin->pad);
+            gli_count_curses(2);
+        }
+    }
+    
+    if (drawtop != -1)
+        gli_damage_rect(win->bbox.left, win->bbox.top + drawtop, 
+            win->bbox.right, win->bbox.top + drawbottom);
+}
+
+/* Compose a line into drawrow, with the style attributes or'd in, and
+    draw it with a single curses call. If the line contains a character 
+    which curses would expand, do nothing and return FALSE. */
+static int draw_line_fast(window_textbuffer_t *dwin, tbline_t *ln, int row)
+{
+    long wx;
+    int ix;
+    int count = 0;
+    
+    for (wx=0; wx<ln->printwords; wx++) {
+        tbpword_t *wd = &(dwin->arena[ln->words+wx]);
+        if (wd->type == wd_Text || wd->type == wd_Blank) {
+            unsigned char *cx = (unsigned char *)&(dwin->chars[ln->pos + wd->pos]);
+            /* unsigned, so that the character doesn't carry any high 
+                style bits. */
+            chtype attr = win_textbuffer_styleattrs[wd->style];
+            for (ix=0; ix<wd->len && count<dwin->width; ix++, cx++, count++) {
+                if (drawcell_table[*cx] != 1)
+                    return FALSE;
+                drawrow[count] = (chtype)(*cx) | attr;
             }
-            else {
-                /* blank lines at bottom */
-                move(orgy+physln, orgx);
-                gli_print_spaces(dwin->width);
+        }
+    }
+    
+    while (count < dwin->width)
+        drawrow[count++] = ' ';
+    mvwaddchnstr(dwin->pad, row, 0, drawrow, dwin->width);
+    gli_count_curses(1);
+    return TRUE;
+}
+
+/* Draw a line one character at a time. A character which would not fit
+    in the rest of the row is left off, along with everything after it,
+    so that nothing spills into the next row of the pad. */
+static void draw_line_slow(window_textbuffer_t *dwin, tbline_t *ln, int row)
+{
+    long wx;
+    int ix;
+    int count = 0;
+    
+    wmove(dwin->pad, row, 0);
+    gli_count_curses(1);
+    for (wx=0; wx<ln->printwords && count<dwin->width; wx++) {
+        tbpword_t *wd = &(dwin->arena[ln->words+wx]);
+        if (wd->type == wd_Text || wd->type == wd_Blank) {
+            unsigned char *cx = (unsigned char *)&(dwin->chars[ln->pos + wd->pos]);
+            /* unsigned, so that waddch() doesn't get fed any high
+                style bits. */
+            wattrset(dwin->pad, win_textbuffer_styleattrs[wd->style]);
+            for (ix=0; ix<wd->len; ix++, cx++) {
+                if (count + drawcell_table[*cx] > dwin->width) {
+                    count = dwin->width;
+                    break;
+                }
+                waddch(dwin->pad, *cx);
+                count += drawcell_table[*cx];
             }
+            gli_count_curses(1 + ix);
         }
     }
+    wattrset(dwin->pad, 0);
+    gli_count_curses(1);
+    /* If the row is exactly full, the cursor has already moved to the
+        next one. */
+    if (getcury(dwin->pad) == row) {
+        wclrtoeol(dwin->pad);
+        gli_count_curses(1);
+    }
+}
+
+/* Copy count rows of the pad, starting at row, into the next screen
+    update at screen line ypos, between the columns of box. Anything past
+    the edge of the terminal (which can happen if -width or -height is too
+    large) is left off. */
+static void flush_rows(window_textbuffer_t *dwin, int row, int count, 
+    int ypos, grect_t *box)
+{
+    int xpos = box->left;
+    int bottom = ypos + count - 1;
+    int right = box->right - 1;
+    
+    if (bottom > LINES-1)
+        bottom = LINES-1;
+    if (right > COLS-1)
+        right = COLS-1;
+    if (bottom < ypos || right < xpos)
+        return;
+    
+    pnoutrefresh(dwin->pad, row, xpos - dwin->owner->bbox.left, ypos, xpos, 
+        bottom, right);
+    gli_count_curses(1);
+}
+
+/* Copy the damaged part of the window's viewport, box (in screen 
+    coordinates), into the next screen update. If touch is set, something
+    else may have drawn over it, so copy all of it. If the viewport has 
+    moved, the whole of it is copied. */
+void win_textbuffer_flush(window_t *win, grect_t *box, int touch)
+{
+    window_textbuffer_t *dwin = win->data;
+    int top, row, count, first;
+    
+    if (!dwin->pad)
+        return;
+    
+    if (dwin->padmoved) {
+        box = &win->bbox;
+        touch = TRUE;
+        dwin->padmoved = FALSE;
+    }
+    
+    top = box->top - win->bbox.top;
+    count = box->bottom - box->top;
+    if (count > dwin->height - top)
+        count = dwin->height - top;
+    if (count <= 0)
+        return;
+    
+    /* The viewport may wrap around the end of the ring. */
+    row = pad_row(dwin, dwin->scrollline + top);
+    first = dwin->padrows - row;
+    if (first > count)
+        first = count;
+    
+    if (touch) {
+        touchline(dwin->pad, row, first);
+        if (first < count)
+            touchline(dwin->pad, 0, count - first);
+    }
+    
+    flush_rows(dwin, row, first, box->top, box);
+    if (first < count)
+        flush_rows(dwin, 0, count - first, box->top + first, box);
 }
 
 void win_textbuffer_redraw(window_t *win)
@@ -670,6 +1464,50 @@ void win_textbuffer_putchar(window_t *win, char ch)
             dwin->dirtyend = lx+1;
         dwin->dirtydelta += 1;
     }
+    
+    search_index_update(dwin);
+}
+
+/* Append a span of (already converted) characters, all in the current
+    style. */
+void win_textbuffer_putbuf(window_t *win, char *buf, long len)
+{
+    window_textbuffer_t *dwin = win->data;
+    long lx;
+    
+    if (len <= 0)
+        return;
+    
+    if (dwin->numchars + len > dwin->charssize) {
+        while (dwin->numchars + len > dwin->charssize)
+            dwin->charssize *= 2;
+        dwin->chars = (char *)realloc(dwin->chars, 
+            dwin->charssize * sizeof(char));
+    }
+    
+    lx = dwin->numchars;
+    
+    if (win->style != dwin->runs[dwin->numruns-1].style) {
+        set_last_run(dwin, win->style);
+    }
+    
+    memcpy(&(dwin->chars[lx]), buf, len * sizeof(char));
+    dwin->numchars += len;
+    
+    if (dwin->dirtybeg == -1) {
+        dwin->dirtybeg = lx;
+        dwin->dirtyend = lx+len;
+        dwin->dirtydelta = len;
+    }
+    else {
+        if (lx < dwin->dirtybeg)
+            dwin->dirtybeg = lx;
+        if (lx+len > dwin->dirtyend)
+            dwin->dirtyend = lx+len;
+        dwin->dirtydelta += len;
+    }
+    
+    search_index_update(dwin);
 }
 
 static void set_last_run(window_textbuffer_t *dwin, glui32 style)
@@ -718,6 +1556,23 @@ static void put_text(window_textbuffer_t *dwin, char *buf, long len,
     }
     dwin->numchars += diff;
     
+    if (dwin->trimmed + pos < dwin->cacheend) {
+        cache_discard(dwin, dwin->trimmed + pos, dwin->cacheend);
+        dwin->cacheend = dwin->trimmed + pos;
+    }
+    
+    /* The pair of characters which ends at pos has changed too. */
+    if (dwin->searchblocks) {
+        long blk = (dwin->trimmed + pos - 1) / SEARCH_BLOCK 
+            - dwin->searchfirst;
+        if (blk < 0)
+            blk = 0;
+        if (blk < dwin->searchblocks)
+            dwin->searchblocks = blk;
+    }
+    if (dwin->searchpos >= pos)
+        dwin->searchpos = -1;
+    
     if (dwin->inbuf) {
         if (dwin->incurs >= pos+oldlen)
             dwin->incurs += diff;
@@ -737,6 +1592,8 @@ static void put_text(window_textbuffer_t *dwin, char *buf, long len,
             dwin->dirtyend = pos+len;
         dwin->dirtydelta += diff;
     }
+    
+    search_index_update(dwin);
 }
 
 void win_textbuffer_clear(window_t *win)
@@ -764,6 +1621,15 @@ void win_textbuffer_clear(window_t *win)
     dwin->scrollpos = 0;
     dwin->lastseenline = 0;
     dwin->drawall = TRUE;
+    dwin->shownline = -1;
+    dwin->stalepos = 0;
+    
+    cache_discard(dwin, 0, dwin->cacheend);
+    dwin->cacheend = 0;
+    
+    dwin->searchblocks = 0;
+    dwin->searchfirst = dwin->trimmed / SEARCH_BLOCK;
+    dwin->searchpos = -1;
 }
 
 void win_textbuffer_trim_buffer(window_t *win)
@@ -771,16 +1637,16 @@ void win_textbuffer_trim_buffer(window_t *win)
     window_textbuffer_t *dwin = win->data;
     long trimsize;
     long lnum, snum, cnum;
-    long lx, wx, rx;
+    long lx, rx;
     tbline_t *ln;
     
-    if (dwin->numchars <= BUFFER_SIZE + BUFFER_SLACK)
+    if (dwin->numchars <= pref_scrollback + BUFFER_SLACK(pref_scrollback))
         return; 
         
-    /* We need to knock BUFFER_SLACK chars off the beginning of the buffer, if
+    /* We need to knock the slack chars off the beginning of the buffer, if
         such are conveniently available. */
         
-    trimsize = dwin->numchars - BUFFER_SIZE;
+    trimsize = dwin->numchars - pref_scrollback;
     if (dwin->dirtybeg != -1 && trimsize > dwin->dirtybeg)
         trimsize = dwin->dirtybeg;
     if (dwin->inbuf && trimsize > dwin->infence) 
@@ -815,6 +1681,33 @@ void win_textbuffer_trim_buffer(window_t *win)
         dwin->dirtyend -= cnum;
     }
     
+    if (dwin->stalepos > cnum)
+        dwin->stalepos -= cnum;
+    else
+        dwin->stalepos = 0;
+    
+    dwin->trimmed += cnum;
+    cache_discard(dwin, 0, dwin->trimmed);
+    
+    /* Drop the index blocks which were entirely trimmed. The one which
+        was cut in half keeps some pairs which are gone now, which does 
+        no harm. */
+    lx = dwin->trimmed / SEARCH_BLOCK - dwin->searchfirst;
+    if (lx >= dwin->searchblocks) {
+        dwin->searchblocks = 0;
+    }
+    else if (lx > 0) {
+        memmove(dwin->searchbits, dwin->searchbits + lx * SEARCH_BITS,
+            (dwin->searchblocks - lx) * SEARCH_BITS);
+        dwin->searchblocks -= lx;
+    }
+    dwin->searchfirst = dwin->trimmed / SEARCH_BLOCK;
+    
+    if (dwin->searchpos >= cnum)
+        dwin->searchpos -= cnum;
+    else
+        dwin->searchpos = -1;
+    
     /* trim runs */
     
     if (snum >= dwin->numruns) {
@@ -836,22 +1729,20 @@ void win_textbuffer_trim_buffer(window_t *win)
         dwin->numruns -= snum;
     }
     
-    /* trim lines */
+    /* trim lines. The word positions are line-relative, so only the line
+        positions need to slide. */
     
     final_lines(dwin, 0, lnum);
     for (lx=lnum; lx<dwin->numlines; lx++) {
         tbline_t *ln2 = &(dwin->lines[lx]);
         ln2->pos -= cnum;
-        for (wx=0; wx<ln2->numwords; wx++) {
-            tbword_t *wd = &(ln2->words[wx]);
-            wd->pos -= cnum;
-        }
     }
 
     if (lnum < dwin->numlines)
         memmove(&(dwin->lines[0]), &(dwin->lines[lnum]), 
             (dwin->numlines - lnum) * sizeof(tbline_t));
     dwin->numlines -= lnum;
+    dwin->linebase += lnum;
 
     /* trim all the other assorted crap */
     
@@ -874,6 +1765,11 @@ void win_textbuffer_trim_buffer(window_t *win)
     else 
         dwin->scrollline = 0;
 
+    if (dwin->shownline >= lnum) 
+        dwin->shownline -= lnum;
+    else 
+        dwin->shownline = -1;
+
     if (dwin->lastseenline > lnum) 
         dwin->lastseenline -= lnum;
     else 
@@ -885,6 +1781,161 @@ void win_textbuffer_trim_buffer(window_t *win)
         dwin->scrollline = 0;
 }
 
+/* Write the window's text, style runs, command history, and line input
+    state into a snapshot. See gtsnap.c. */
+void win_textbuffer_save(window_t *win, gli_snapshot_t *snap)
+{
+    window_textbuffer_t *dwin = win->data;
+    long ix;
+    int jx;
+    glui32 count;
+    char *cx;
+    
+    gli_snap_put_int(snap, dwin->numchars);
+    gli_snap_put_buffer(snap, dwin->chars, dwin->numchars);
+    
+    gli_snap_put_int(snap, dwin->numruns);
+    for (ix=0; ix<dwin->numruns; ix++) {
+        gli_snap_put_int(snap, dwin->runs[ix].style);
+        gli_snap_put_int(snap, dwin->runs[ix].pos);
+    }
+    
+    /* The command history, oldest first. */
+    count = 0;
+    if (dwin->history) {
+        for (jx=dwin->historyfirst; jx != dwin->historypresent; 
+            jx = (jx+1) % pref_historylen)
+            count++;
+    }
+    gli_snap_put_int(snap, count);
+    if (count) {
+        for (jx=dwin->historyfirst; jx != dwin->historypresent; 
+            jx = (jx+1) % pref_historylen) {
+            cx = dwin->history[jx];
+            if (!cx)
+                cx = "";
+            gli_snap_put_int(snap, strlen(cx));
+            gli_snap_put_buffer(snap, cx, strlen(cx));
+        }
+    }
+    
+    if (win->line_request) {
+        gli_snap_put_int(snap, dwin->inmax);
+        gli_snap_put_int(snap, dwin->inunicode);
+        gli_snap_put_int(snap, dwin->inecho);
+        gli_snap_put_int(snap, dwin->intermkeys);
+        gli_snap_put_int(snap, dwin->infence);
+        gli_snap_put_int(snap, dwin->incurs);
+        gli_snap_put_int(snap, dwin->origstyle);
+        gli_snap_put_inbuf(snap, dwin->inbuf, dwin->inmax, dwin->inunicode,
+            dwin->inarrayrock);
+    }
+}
+
+/* Read back what win_textbuffer_save() wrote, into a new window. The 
+    text is laid out at the next update. */
+void win_textbuffer_load(window_t *win, gli_snapshot_t *snap)
+{
+    window_textbuffer_t *dwin = win->data;
+    glui32 numchars, numruns, count, len, ix;
+    glui32 style, pos;
+    char *cx;
+    tbrun_t *runs;
+    
+    numchars = gli_snap_get_int(snap);
+    if (snap->error || numchars > snap->len - snap->pos) {
+        snap->error = TRUE;
+        return;
+    }
+    if (numchars > dwin->charssize) {
+        cx = (char *)realloc(dwin->chars, numchars * sizeof(char));
+        if (!cx) {
+            snap->error = TRUE;
+            return;
+        }
+        dwin->chars = cx;
+        dwin->charssize = numchars;
+    }
+    gli_snap_get_buffer(snap, dwin->chars, numchars);
+    dwin->numchars = numchars;
+    search_index_update(dwin);
+    
+    numruns = gli_snap_get_int(snap);
+    if (snap->error || numruns == 0 
+        || numruns > (snap->len - snap->pos) / 8) {
+        snap->error = TRUE;
+        return;
+    }
+    if (numruns > dwin->runssize) {
+        runs = (tbrun_t *)realloc(dwin->runs, numruns * sizeof(tbrun_t));
+        if (!runs) {
+            snap->error = TRUE;
+            return;
+        }
+        dwin->runs = runs;
+        dwin->runssize = numruns;
+    }
+    for (ix=0; ix<numruns; ix++) {
+        style = gli_snap_get_int(snap);
+        pos = gli_snap_get_int(snap);
+        if (snap->error || style >= style_NUMSTYLES || pos > numchars
+            || (ix == 0 && pos != 0) 
+            || (ix > 0 && pos < dwin->runs[ix-1].pos)) {
+            snap->error = TRUE;
+            return;
+        }
+        dwin->runs[ix].style = style;
+        dwin->runs[ix].pos = pos;
+    }
+    dwin->numruns = numruns;
+    
+    count = gli_snap_get_int(snap);
+    for (ix=0; ix<count && !snap->error; ix++) {
+        len = gli_snap_get_int(snap);
+        if (snap->error || len > snap->len - snap->pos) {
+            snap->error = TRUE;
+            return;
+        }
+        if (!dwin->history) {
+            snap->pos += len;
+            continue;
+        }
+        cx = (char *)malloc((len+1) * sizeof(char));
+        if (!cx) {
+            snap->error = TRUE;
+            return;
+        }
+        gli_snap_get_buffer(snap, cx, len);
+        cx[len] = '\0';
+        history_add(dwin, cx);
+    }
+    dwin->historypos = dwin->historypresent;
+    
+    if (win->line_request) {
+        dwin->inmax = gli_snap_get_int(snap);
+        dwin->inunicode = (gli_snap_get_int(snap) != 0);
+        dwin->inecho = (gli_snap_get_int(snap) != 0);
+        dwin->intermkeys = gli_snap_get_int(snap);
+        dwin->infence = gli_snap_get_int(snap);
+        dwin->incurs = gli_snap_get_int(snap);
+        dwin->origstyle = gli_snap_get_int(snap);
+        if (snap->error || dwin->inmax < 0 || dwin->infence < 0 
+            || dwin->infence > dwin->incurs || dwin->incurs > numchars
+            || dwin->origstyle >= style_NUMSTYLES) {
+            snap->error = TRUE;
+            return;
+        }
+        dwin->inbuf = gli_snap_get_inbuf(snap, dwin->inmax, 
+            dwin->inunicode, &dwin->inarrayrock);
+    }
+    
+    /* All of the text is new. */
+    dwin->dirtybeg = 0;
+    dwin->dirtyend = numchars;
+    dwin->dirtydelta = numchars;
+    dwin->drawall = TRUE;
+}
+
 void win_textbuffer_place_cursor(window_t *win, int *xpos, int *ypos)
 {
     window_textbuffer_t *dwin = win->data;
@@ -942,6 +1993,8 @@ void win_textbuffer_set_paging(window_t *win, int forcetoend)
         && dwin->lastseenline - 0 < dwin->numlines - dwin->height) {
         /* scroll lastseenline to top, stick there */
         val = dwin->lastseenline - 1;
+        if (val < 0)
+            val = 0;
     }
     else {
         /* scroll to bottom, set lastseenline to end. */
@@ -957,7 +2010,6 @@ void win_textbuffer_set_paging(window_t *win, int forcetoend)
             dwin->scrollpos = dwin->numchars;
         else
             dwin->scrollpos = dwin->lines[val].pos;
-        dwin->drawall = TRUE;
         updatetext(dwin);
     }
 }
@@ -1033,6 +2085,7 @@ void win_textbuffer_cancel_line(window_t *win, event_t *ev)
     ev->val1 = len;
     
     win->line_request = FALSE;
+    gli_window_input_changed(win);
     dwin->inbuf = NULL;
     dwin->inmax = 0;
     dwin->inecho = FALSE;
@@ -1092,12 +2145,36 @@ static void export_input_line(void *buf, int unicode, long len, char *chars)
     }
 }
 
+/* Add a line to the end of the command history. The history takes over
+    the string. */
+static void history_add(window_textbuffer_t *dwin, char *cx)
+{
+    if (dwin->history[dwin->historypresent]) {
+        free(dwin->history[dwin->historypresent]);
+        dwin->history[dwin->historypresent] = NULL;
+    }
+    dwin->history[dwin->historypresent] = cx;
+    dwin->historypresent++;
+    if (dwin->historypresent >= pref_historylen)
+        dwin->historypresent -= pref_historylen;
+    if (dwin->historypresent == dwin->historyfirst) {
+        dwin->historyfirst++;
+        if (dwin->historyfirst >= pref_historylen)
+            dwin->historyfirst -= pref_historylen;
+    }
+    if (dwin->history[dwin->historypresent]) {
+        free(dwin->history[dwin->historypresent]);
+        dwin->history[dwin->historypresent] = NULL;
+    }
+}
+
 /* Keybinding functions. */
 
 /* Any key, during character input. Ends character input. */
 void gcmd_buffer_accept_key(window_t *win, glui32 arg)
 {
     win->char_request = FALSE; 
+    gli_window_input_changed(win);
     arg = gli_input_from_native(arg);
     gli_event_store(evtype_CharInput, win, arg, 0);
 }
@@ -1134,23 +2211,7 @@ void gcmd_buffer_accept_line(window_t *win, glui32 arg)
         cx = (char *)malloc((1+len) * sizeof(char));
         memcpy(cx, &(dwin->chars[dwin->infence]), len);
         cx[len] = '\0';
-        if (dwin->history[dwin->historypresent]) {
-            free(dwin->history[dwin->historypresent]);
-            dwin->history[dwin->historypresent] = NULL;
-        }
-        dwin->history[dwin->historypresent] = cx;
-        dwin->historypresent++;
-        if (dwin->historypresent >= pref_historylen)
-            dwin->historypresent -= pref_historylen;
-        if (dwin->historypresent == dwin->historyfirst) {
-            dwin->historyfirst++;
-            if (dwin->historyfirst >= pref_historylen)
-                dwin->historyfirst -= pref_historylen;
-        }
-        if (dwin->history[dwin->historypresent]) {
-            free(dwin->history[dwin->historypresent]);
-            dwin->history[dwin->historypresent] = NULL;
-        }
+        history_add(dwin, cx);
     }
 
     /* Store in event buffer. */
@@ -1176,6 +2237,7 @@ void gcmd_buffer_accept_line(window_t *win, glui32 arg)
 
     gli_event_store(evtype_LineInput, win, len, termkey);
     win->line_request = FALSE;
+    gli_window_input_changed(win);
     dwin->inbuf = NULL;
     dwin->inmax = 0;
     dwin->inecho = FALSE;
@@ -1377,7 +2439,230 @@ void gcmd_buffer_scroll(window_t *win, glui32 arg)
             dwin->scrollpos = dwin->numchars;
         else
             dwin->scrollpos = dwin->lines[val].pos;
-        dwin->drawall = TRUE;
+        updatetext(dwin);
+    }
+
+    if (dwin->lastseenline < dwin->scrollline) {
+        dwin->lastseenline = dwin->scrollline;
+    }
+    if (dwin->lastseenline >= dwin->numlines - dwin->height) {
+        dwin->lastseenline = dwin->numlines;
+    }
+}
+
+/* Scrollback search. The index lets us skip the blocks of text which 
+    can't contain a match: a match beginning in one block can only use
+    character pairs from that block and the next. */
+
+static char searchstr[256];
+static int searchlen = 0;
+
+#define search_fold(ch) \
+    (((ch) >= 'A' && (ch) <= 'Z') ? ((ch) + ('a' - 'A')) : (ch))
+#define search_hash(ch1, ch2) \
+    (((unsigned char)(ch1) * 33 + (unsigned char)(ch2)) & 0xFF)
+
+/* Index any blocks which have been completed since the last call. This
+    runs whenever text is added, so each block is indexed once, as soon
+    as it is complete -- that is, when the character after it exists, 
+    since its last pair ends there. */
+static void search_index_update(window_textbuffer_t *dwin)
+{
+    long blk, cx, beg, end;
+    int hx;
+    unsigned char *bits;
+    char *chars = dwin->chars;
+    
+    while (TRUE) {
+        blk = dwin->searchfirst + dwin->searchblocks;
+        end = (blk+1) * SEARCH_BLOCK - dwin->trimmed;
+        if (end >= dwin->numchars)
+            break;
+        beg = blk * SEARCH_BLOCK - dwin->trimmed;
+        if (beg < 0)
+            beg = 0;
+        
+        if (dwin->searchblocks >= dwin->searchsize) {
+            if (dwin->searchsize == 0)
+                dwin->searchsize = 16;
+            else
+                dwin->searchsize *= 2;
+            dwin->searchbits = (unsigned char *)realloc(dwin->searchbits,
+                dwin->searchsize * SEARCH_BITS);
+            if (!dwin->searchbits) {
+                dwin->searchblocks = 0;
+                dwin->searchsize = 0;
+                return;
+            }
+        }
+        
+        bits = dwin->searchbits + dwin->searchblocks * SEARCH_BITS;
+        memset(bits, 0, SEARCH_BITS);
+        for (cx=beg; cx<end; cx++) {
+            hx = search_hash(search_fold(chars[cx]), 
+                search_fold(chars[cx+1]));
+            bits[hx >> 3] |= (1 << (hx & 7));
+        }
+        dwin->searchblocks++;
+    }
+}
+
+/* Could a match begin in block blk, given the bitmap of the pairs in the
+    search string? If the index doesn't cover the block and the one after
+    it, the answer is yes. */
+static int search_block_possible(window_textbuffer_t *dwin, long blk, 
+    unsigned char *qbits)
+{
+    long ix = blk - dwin->searchfirst;
+    unsigned char *bits;
+    int jx;
+    
+    if (ix < 0 || ix+1 >= dwin->searchblocks)
+        return TRUE;
+    
+    bits = dwin->searchbits + ix * SEARCH_BITS;
+    for (jx=0; jx<SEARCH_BITS; jx++) {
+        if (qbits[jx] & ~(bits[jx] | bits[jx+SEARCH_BITS]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Search for str (already folded). Searching forward, this finds the 
+    first match at or after pos; backward, the last match before pos.
+    Returns -1 if there is none. */
+static long search_text(window_textbuffer_t *dwin, char *str, int len, 
+    long pos, int forward)
+{
+    unsigned char qbits[SEARCH_BITS];
+    long lastpos, blk, cx, beg, end;
+    int ix, hx;
+    char *chars = dwin->chars;
+    
+    lastpos = dwin->numchars - len;
+    if (len <= 0 || lastpos < 0)
+        return -1;
+    
+    /* Only pairs which begin within SEARCH_BLOCK characters of the start
+        of the match are sure to lie in the block or the next one. */
+    memset(qbits, 0, SEARCH_BITS);
+    for (ix=0; ix+1<len && ix<SEARCH_BLOCK; ix++) {
+        hx = search_hash(str[ix], str[ix+1]);
+        qbits[hx >> 3] |= (1 << (hx & 7));
+    }
+    
+    if (forward) {
+        if (pos < 0)
+            pos = 0;
+        for (blk = (dwin->trimmed + pos) / SEARCH_BLOCK; 
+            pos <= lastpos; 
+            blk++) {
+            end = (blk+1) * SEARCH_BLOCK - dwin->trimmed;
+            if (end > lastpos+1)
+                end = lastpos+1;
+            if (search_block_possible(dwin, blk, qbits)) {
+                for (cx=pos; cx<end; cx++) {
+                    for (ix=0; ix<len; ix++) {
+                        if (search_fold(chars[cx+ix]) != str[ix])
+                            break;
+                    }
+                    if (ix == len)
+                        return cx;
+                }
+            }
+            pos = end;
+        }
+    }
+    else {
+        if (pos > lastpos+1)
+            pos = lastpos+1;
+        while (pos > 0) {
+            blk = (dwin->trimmed + pos - 1) / SEARCH_BLOCK;
+            beg = blk * SEARCH_BLOCK - dwin->trimmed;
+            if (beg < 0)
+                beg = 0;
+            if (search_block_possible(dwin, blk, qbits)) {
+                for (cx=pos-1; cx>=beg; cx--) {
+                    for (ix=0; ix<len; ix++) {
+                        if (search_fold(chars[cx+ix]) != str[ix])
+                            break;
+                    }
+                    if (ix == len)
+                        return cx;
+                }
+            }
+            pos = beg;
+        }
+    }
+    
+    return -1;
+}
+
+/* Prompt for a string, and scroll to the next match (arg is gcmd_Down) or
+    the previous one (gcmd_Up). The matching line is brought to the top of
+    the window. The search starts at the last match, if that's still on 
+    the screen, or else at the top of the window. */
+void gcmd_buffer_search(window_t *win, glui32 arg)
+{
+    window_textbuffer_t *dwin = win->data;
+    char buf[256];
+    char str[256];
+    int len, ix;
+    long pos, lx, maxval;
+    
+    len = searchlen;
+    memcpy(buf, searchstr, len);
+    if (!gli_msgin_getline((arg == gcmd_Up) ? "Search back: " 
+        : "Search forward: ", buf, sizeof(buf), &len))
+        return;
+    if (len == 0)
+        return;
+    memcpy(searchstr, buf, len);
+    searchlen = len;
+    for (ix=0; ix<len; ix++)
+        str[ix] = search_fold(buf[ix]);
+    
+    if (dwin->numlines == 0)
+        return;
+    
+    lx = dwin->scrollline;
+    if (dwin->searchpos >= 0 && dwin->searchpos >= dwin->lines[lx].pos
+        && (lx + dwin->height >= dwin->numlines
+            || dwin->searchpos < dwin->lines[lx + dwin->height].pos)) {
+        pos = dwin->searchpos;
+        if (arg != gcmd_Up)
+            pos++;
+    }
+    else {
+        pos = dwin->lines[lx].pos;
+        if (arg != gcmd_Up && lx+1 < dwin->numlines)
+            pos = dwin->lines[lx+1].pos;
+    }
+    
+    pos = search_text(dwin, str, len, pos, (arg != gcmd_Up));
+    if (pos < 0) {
+        gli_msgline("Not found.");
+        return;
+    }
+    dwin->searchpos = pos;
+    
+    lx = find_line_by_pos(dwin, pos);
+    if (dwin->stalepos > 0 && lx < find_line_by_pos(dwin, dwin->stalepos)) {
+        relayout_stale(dwin, lx);
+        lx = find_line_by_pos(dwin, pos);
+    }
+    
+    maxval = dwin->numlines - dwin->height;
+    if (lx > maxval)
+        lx = maxval;
+    if (lx < 0)
+        lx = 0;
+    
+    /* If relayout_stale() ran, the pad has to be redrawn even if the
+        window doesn't scroll. */
+    if (lx != dwin->scrollline || dwin->drawall) {
+        dwin->scrollline = lx;
+        dwin->scrollpos = dwin->lines[lx].pos;
         updatetext(dwin);
     }
 
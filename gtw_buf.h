@@ -10,7 +10,7 @@
 #define wd_EndLine (3) /* End of line character */
 #define wd_EndPage (4) /* End of the whole text */
 
-/* One word */
+/* One word, as used during layout. */
 typedef struct tbword_struct {
     short type; /* A wd_* constant */
     short style;
@@ -18,6 +18,24 @@ typedef struct tbword_struct {
     long len; /* This is zero for wd_EndLine and wd_EndPage. */
 } tbword_t;
 
+/* One word of a laid-out line, packed down to eight bytes. These live in
+    the window's word arena. */
+typedef struct tbpword_struct {
+    glui32 pos; /* Position in the chars array, relative to the start of
+        the line. */
+    unsigned short len; /* Blank words are capped at MAX_WORD_LEN; text 
+        words are never wider than the window. */
+    unsigned char type;
+    unsigned char style;
+} tbpword_t;
+
+#define MAX_WORD_LEN (0xFFFF)
+
+/* The scrollback search index divides the text into blocks of this many
+    characters, and keeps a bitmap of SEARCH_BITS bytes for each. */
+#define SEARCH_BLOCK (256)
+#define SEARCH_BITS (32)
+
 /* One style run */
 typedef struct tbrun_struct {
     short style;
@@ -27,7 +45,8 @@ typedef struct tbrun_struct {
 /* One laid-out line of words */
 typedef struct tbline_struct {
     int numwords;
-    tbword_t *words;
+    long words; /* Index of the first word in the window's word arena, or
+        -1 if there are no words. */
     
     long pos; /* Position in the chars array. */
     long len; /* Number of characters, including blanks */
@@ -37,6 +56,24 @@ typedef struct tbline_struct {
         blank word, if that goes outside the window.) */
 } tbline_t;
 
+/* The layout of one paragraph at one width, kept so that going back to
+    that width doesn't mean laying the paragraph out again. The line and
+    word arrays live in the same block as the structure. */
+typedef struct tbcache_struct tbcache_t;
+struct tbcache_struct {
+    long pos; /* Position of the start of the paragraph, counting the
+        characters which have been trimmed off the front of the buffer. */
+    long len; /* Number of characters, including the final newline. */
+    int width;
+    long numlines;
+    tbline_t *lines; /* Line positions are relative to the paragraph start,
+        and word indexes are relative to the words array. */
+    tbpword_t *words;
+    long size; /* Bytes in the whole block. */
+    tbcache_t *chain; /* Next entry in the same hash bucket. */
+    tbcache_t *prev, *next; /* Most recently used entries come first. */
+};
+
 typedef struct window_textbuffer_struct {
     window_t *owner;
     
@@ -52,7 +89,26 @@ typedef struct window_textbuffer_struct {
         so the old end of the dirty region == (dirtyend - dirtydelta). 
         If dirtybeg == -1, dirtydelta is invalid. */
     int drawall; /* Does the whole window need to be redrawn at the next
-        update? (Set when the text is scrolled, for example.) */
+        update? (Set when the window is cleared, for example.) */
+    long shownline; /* The scrollline value as of the last update, or -1 
+        if the lines on screen don't line up with it any more. When this 
+        differs from scrollline, the window has scrolled. */
+
+    /* The rendered lines. The pad is a ring of padrows rows: line lx is
+        drawn in row (linebase + lx) % padrows, and padline[] records
+        which line (linebase + lx) each row holds, if any.
+        Scrolling back over lines that are still in the ring only moves
+        the viewport which is copied to the screen. */
+    WINDOW *pad;
+    int padrows;
+    long *padline;
+    long linebase; /* Lines ever trimmed off the front of the buffer. */
+    int padmoved; /* The viewport has moved since the last flush. */
+
+    long stalepos; /* Lines before this position were laid out for an
+        older width, and are laid out again only when they are scrolled
+        into view. This is always the start of a line, or zero if nothing
+        is stale. */
     
     tbline_t *lines;
     long numlines;
@@ -70,6 +126,33 @@ typedef struct window_textbuffer_struct {
     tbword_t *tmpwords;
     long tmpwordssize;
 
+    /* The words of all the laid-out lines. Each line owns a contiguous
+        slice; slices of discarded lines are garbage until the arena is
+        compacted. */
+    tbpword_t *arena;
+    long numarena; /* Words in use, including garbage. */
+    long arenasize;
+    long arenalive; /* Words that belong to a line. */
+
+    /* Paragraph layouts, for widths we may return to. The total size is 
+        held under pref_layoutcache kilobytes. */
+    tbcache_t **cachehash; /* NULL until something is cached. */
+    tbcache_t *cachefirst, *cachelast;
+    long cachesize; /* Bytes in all the entries. */
+    long cacheend; /* No cached paragraph extends past this position. */
+    long trimmed; /* Number of characters ever trimmed off the front. Cache
+        positions include this, so that they survive a trim. */
+
+    /* Scrollback search index. Each block's bitmap has a bit set for every
+        (case-folded) pair of characters that begins in the block. Blocks
+        are numbered from the start of all text, including trimmed text.
+        Only complete blocks are indexed. */
+    unsigned char *searchbits;
+    long searchblocks; /* Number of blocks indexed. */
+    long searchsize; /* Number of blocks allocated. */
+    long searchfirst; /* Block number of the first indexed block. */
+    long searchpos; /* Position of the last match found, or -1. */
+
     /* Command history. */
     char **history;
     int historypos;
@@ -98,9 +181,13 @@ extern void win_textbuffer_destroy(window_textbuffer_t *dwin);
 extern void win_textbuffer_rearrange(window_t *win, grect_t *box);
 extern void win_textbuffer_redraw(window_t *win);
 extern void win_textbuffer_update(window_t *win);
+extern void win_textbuffer_flush(window_t *win, grect_t *box, int touch);
 extern void win_textbuffer_putchar(window_t *win, char ch);
+extern void win_textbuffer_putbuf(window_t *win, char *buf, long len);
 extern void win_textbuffer_clear(window_t *win);
 extern void win_textbuffer_trim_buffer(window_t *win);
+extern void win_textbuffer_save(window_t *win, gli_snapshot_t *snap);
+extern void win_textbuffer_load(window_t *win, gli_snapshot_t *snap);
 extern void win_textbuffer_place_cursor(window_t *win, int *xpos, int *ypos);
 extern void win_textbuffer_set_paging(window_t *win, int forcetoend);
 extern void win_textbuffer_init_line(window_t *win, void *buf, int unicode, int maxlen, int initlen);
@@ -113,4 +200,5 @@ extern void gcmd_buffer_move_cursor(window_t *win, glui32 arg);
 extern void gcmd_buffer_delete(window_t *win, glui32 arg);
 extern void gcmd_buffer_history(window_t *win, glui32 arg);
 extern void gcmd_buffer_scroll(window_t *win, glui32 arg);
+extern void gcmd_buffer_search(window_t *win, glui32 arg);
 
@@ -7,19 +7,25 @@
 #include "gtoption.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <curses.h>
 #include "glk.h"
 #include "glkterm.h"
 #include "gtw_grid.h"
 
-/* A grid of characters. We store the window as a list of lines (see
-    gtwgrid.h); within a line, just store an array of characters and
-    an array of style bytes, the same size. (If we ever have more than
-    255 styles, things will have to be changed, but that's unlikely.)
+/* A grid of characters. We store the window as an array of characters and
+    an array of style bytes, the same size, each laid out row by row with
+    a fixed stride; the list of lines (see gtwgrid.h) points into them.
+    (If we ever have more than 255 styles, things will have to be changed,
+    but that's unlikely.)
+   Each line also keeps a copy of what was last drawn, so that a program
+    which rewrites its whole status line every turn only costs us the 
+    characters that actually changed.
 */
 
-static void init_lines(window_textgrid_t *dwin, int beg, int end, int linewid);
+static int grow_planes(window_textgrid_t *dwin, int stride, int numrows);
 static void final_lines(window_textgrid_t *dwin);
+static void forget_shown(window_textgrid_t *dwin);
 static void export_input_line(void *buf, int unicode, long len, char *chars);
 static void import_input_line(tgline_t *ln, int offset, void *buf, 
     int unicode, long len);
@@ -27,6 +33,11 @@ static void import_input_line(tgline_t *ln, int offset, void *buf,
 /* Array of curses.h attribute values, one for each style. */
 chtype win_textgrid_styleattrs[style_NUMSTYLES];
 
+/* When two changed spans in a line are separated by fewer than this many
+    unchanged characters, it's cheaper to draw straight through the gap
+    than to move the cursor over it. */
+#define SPAN_GAP (4)
+
 /* This macro sets the appropriate dirty values, when a single character
     (at px, py) is changed. */
 #define setposdirty(dwn, ll, px, py)   \
@@ -45,6 +56,7 @@ window_textgrid_t *win_textgrid_create(window_t *win)
     window_textgrid_t *dwin = (window_textgrid_t *)malloc(sizeof(window_textgrid_t));
     dwin->owner = win;
     
+    dwin->curswin = NULL;
     dwin->width = 0;
     dwin->height = 0;
     
@@ -53,6 +65,11 @@ window_textgrid_t *win_textgrid_create(window_t *win)
     
     dwin->linessize = 0;
     dwin->lines = NULL;
+    dwin->stride = 0;
+    dwin->chars = NULL;
+    dwin->attrs = NULL;
+    dwin->shownchars = NULL;
+    dwin->shownattrs = NULL;
     dwin->dirtybeg = -1;
     dwin->dirtyend = -1;
     
@@ -75,6 +92,10 @@ void win_textgrid_destroy(window_textgrid_t *dwin)
     }
     
     dwin->owner = NULL;
+    if (dwin->curswin) {
+        delwin(dwin->curswin);
+        dwin->curswin = NULL;
+    }
     if (dwin->lines) {
         final_lines(dwin);
     }
@@ -83,8 +104,8 @@ void win_textgrid_destroy(window_textgrid_t *dwin)
 
 void win_textgrid_rearrange(window_t *win, grect_t *box)
 {
-    int ix, jx, oldval;
     int newwid, newhgt;
+    int stride, numrows;
     window_textgrid_t *dwin = win->data;
     dwin->owner->bbox = *box;
     
@@ -92,110 +113,171 @@ void win_textgrid_rearrange(window_t *win, grect_t *box)
     newhgt = box->bottom - box->top;
     
     if (dwin->lines == NULL) {
-        dwin->linessize = (newhgt+1);
-        dwin->lines = (tgline_t *)malloc(dwin->linessize * sizeof(tgline_t));
-        if (!dwin->lines)
+        if (!grow_planes(dwin, newwid+1, newhgt+1))
             return;
-        init_lines(dwin, 0, dwin->linessize, newwid);
     }
-    else {
-        if (newhgt > dwin->linessize) {
-            oldval = dwin->linessize;
-            dwin->linessize = (newhgt+1) * 2;
-            dwin->lines = (tgline_t *)realloc(dwin->lines, 
-                dwin->linessize * sizeof(tgline_t));
-            if (!dwin->lines)
-                return;
-            init_lines(dwin, oldval, dwin->linessize, newwid);
-        }
-        if (newhgt > dwin->height) {
-            for (jx=dwin->height; jx<newhgt; jx++) {
-                tgline_t *ln = &(dwin->lines[jx]);
-                for (ix=0; ix<ln->size; ix++) {
-                    ln->chars[ix] = ' ';
-                    ln->attrs[ix] = style_Normal;
-                }
-            }
-        }
-        for (jx=0; jx<newhgt; jx++) {
-            tgline_t *ln = &(dwin->lines[jx]);
-            if (newwid > ln->size) {
-                oldval = ln->size;
-                ln->size = (newwid+1) * 2;
-                ln->chars = (char *)realloc(ln->chars, 
-                    ln->size * sizeof(char));
-                ln->attrs = (unsigned char *)realloc(ln->attrs, 
-                    ln->size * sizeof(unsigned char));
-                if (!ln->chars || !ln->attrs) {
-                    dwin->lines = NULL;
-                    return;
-                }
-                for (ix=oldval; ix<ln->size; ix++) {
-                    ln->chars[ix] = ' ';
-                    ln->attrs[ix] = style_Normal;
-                }
-            }
-        }
+    else if (newwid > dwin->stride || newhgt > dwin->linessize) {
+        stride = dwin->stride;
+        if (newwid > stride)
+            stride = (newwid+1) * 2;
+        numrows = dwin->linessize;
+        if (newhgt > numrows)
+            numrows = (newhgt+1) * 2;
+        if (!grow_planes(dwin, stride, numrows))
+            return;
+    }
+    
+    if (newhgt > dwin->height) {
+        stride = dwin->stride;
+        memset(dwin->chars + dwin->height * stride, ' ', 
+            (newhgt - dwin->height) * stride);
+        memset(dwin->attrs + dwin->height * stride, style_Normal, 
+            (newhgt - dwin->height) * stride);
     }
     
     dwin->width = newwid;
     dwin->height = newhgt;
 
+    /* The window may have moved, so the screen can't be trusted. Start
+        over with a fresh pad, since the curses screen may have been
+        replaced too. */
+    forget_shown(dwin);
+    if (dwin->curswin) {
+        delwin(dwin->curswin);
+        dwin->curswin = NULL;
+    }
+    if (newwid > 0 && newhgt > 0) {
+        dwin->curswin = newpad(newhgt, newwid);
+        if (dwin->curswin)
+            leaveok(dwin->curswin, TRUE);
+    }
+
     dwin->dirtybeg = 0;
     dwin->dirtyend = dwin->height;
 }
 
-static void init_lines(window_textgrid_t *dwin, int beg, int end, int linewid)
+/* Reallocate the cell planes with the given stride and number of rows,
+    keeping the existing cells; new cells are blank. The lines are pointed
+    at the new planes. Returns FALSE (and leaves the window with no lines)
+    if memory runs out. */
+static int grow_planes(window_textgrid_t *dwin, int stride, int numrows)
 {
-    int ix, jx;
-
-    for (jx=beg; jx<end; jx++) {
-        tgline_t *ln = &(dwin->lines[jx]);
-        ln->size = (linewid+1);
-        ln->dirtybeg = -1;
-        ln->dirtyend = -1;
-        ln->chars = (char *)malloc(ln->size * sizeof(char));
-        ln->attrs = (unsigned char *)malloc(ln->size * sizeof(unsigned char));
-        if (!ln->chars || !ln->size) {
-            dwin->lines = NULL;
-            return;
-        }
-        for (ix=0; ix<ln->size; ix++) {
-            ln->chars[ix] = ' ';
-            ln->attrs[ix] = style_Normal;
+    int jx, oldrows;
+    long count = (long)stride * numrows;
+    char *chars, *shownchars;
+    unsigned char *attrs, *shownattrs;
+    tgline_t *lines;
+    
+    chars = (char *)malloc(count * sizeof(char));
+    attrs = (unsigned char *)malloc(count * sizeof(unsigned char));
+    shownchars = (char *)malloc(count * sizeof(char));
+    shownattrs = (unsigned char *)malloc(count * sizeof(unsigned char));
+    lines = (tgline_t *)realloc(dwin->lines, numrows * sizeof(tgline_t));
+    if (!chars || !attrs || !shownchars || !shownattrs || !lines) {
+        if (chars)
+            free(chars);
+        if (attrs)
+            free(attrs);
+        if (shownchars)
+            free(shownchars);
+        if (shownattrs)
+            free(shownattrs);
+        if (lines)
+            dwin->lines = lines;
+        final_lines(dwin);
+        return FALSE;
+    }
+    
+    memset(chars, ' ', count);
+    memset(attrs, style_Normal, count);
+    memset(shownchars, ' ', count);
+    memset(shownattrs, SHOWN_UNKNOWN, count);
+    
+    oldrows = (dwin->chars) ? dwin->linessize : 0;
+    for (jx=0; jx<oldrows; jx++) {
+        memcpy(chars + jx * stride, dwin->chars + jx * dwin->stride,
+            dwin->stride * sizeof(char));
+        memcpy(attrs + jx * stride, dwin->attrs + jx * dwin->stride,
+            dwin->stride * sizeof(unsigned char));
+    }
+    
+    for (jx=0; jx<numrows; jx++) {
+        tgline_t *ln = &(lines[jx]);
+        ln->chars = chars + jx * stride;
+        ln->attrs = attrs + jx * stride;
+        ln->shownchars = shownchars + jx * stride;
+        ln->shownattrs = shownattrs + jx * stride;
+        if (jx >= oldrows) {
+            ln->dirtybeg = -1;
+            ln->dirtyend = -1;
         }
     }
+    
+    if (dwin->chars) {
+        free(dwin->chars);
+        free(dwin->attrs);
+        free(dwin->shownchars);
+        free(dwin->shownattrs);
+    }
+    
+    dwin->lines = lines;
+    dwin->linessize = numrows;
+    dwin->stride = stride;
+    dwin->chars = chars;
+    dwin->attrs = attrs;
+    dwin->shownchars = shownchars;
+    dwin->shownattrs = shownattrs;
+    
+    return TRUE;
+}
+
+/* Mark every cell as unknown, so that it's redrawn at the next update. */
+static void forget_shown(window_textgrid_t *dwin)
+{
+    memset(dwin->shownattrs, SHOWN_UNKNOWN, 
+        (long)dwin->linessize * dwin->stride);
 }
 
 static void final_lines(window_textgrid_t *dwin)
 {
-    int jx;
-    
-    for (jx=0; jx<dwin->linessize; jx++) {
-        tgline_t *ln = &(dwin->lines[jx]);
-        if (ln->chars) {
-            free(ln->chars);
-            ln->chars = NULL;
-        }
-        if (ln->attrs) {
-            free(ln->attrs);
-            ln->attrs = NULL;
-        }
+    if (dwin->chars) {
+        free(dwin->chars);
+        dwin->chars = NULL;
+    }
+    if (dwin->attrs) {
+        free(dwin->attrs);
+        dwin->attrs = NULL;
+    }
+    if (dwin->shownchars) {
+        free(dwin->shownchars);
+        dwin->shownchars = NULL;
+    }
+    if (dwin->shownattrs) {
+        free(dwin->shownattrs);
+        dwin->shownattrs = NULL;
     }
     
-    free(dwin->lines);
-    dwin->lines = NULL;
+    if (dwin->lines) {
+        free(dwin->lines);
+        dwin->lines = NULL;
+    }
+    dwin->linessize = 0;
+    dwin->stride = 0;
 }
 
 static void updatetext(window_textgrid_t *dwin, int drawall)
 {
-    int ix, jx, beg, iix;
+    int ix, jx, beg, end, iix;
     int orgx, orgy;
+    WINDOW *cwin = dwin->curswin;
+    int drawtop, drawbottom;
     unsigned char curattr;
     
     if (drawall) {
         dwin->dirtybeg = 0;
         dwin->dirtyend = dwin->height;
+        /* the screen has been erased, so draw everything */
+        forget_shown(dwin);
     }
     else {
         if (dwin->dirtyend > dwin->height) {
@@ -203,11 +285,13 @@ static void updatetext(window_textgrid_t *dwin, int drawall)
         }
     }
     
-    if (dwin->dirtybeg == -1)
+    if (dwin->dirtybeg == -1 || !cwin)
         return;
     
     orgx = dwin->owner->bbox.left;
     orgy = dwin->owner->bbox.top;
+    drawtop = -1;
+    drawbottom = -1;
     
     for (jx=dwin->dirtybeg; jx<dwin->dirtyend; jx++) {
         tgline_t *ln = &(dwin->lines[jx]);
@@ -224,20 +308,48 @@ static void updatetext(window_textgrid_t *dwin, int drawall)
         if (ln->dirtybeg == -1)
             continue;
         
-        /* draw one line. */
-        move(orgy+jx, orgx+ln->dirtybeg);
-        
-        ix=ln->dirtybeg;
-        while (ix<ln->dirtyend) {
+        /* draw the spans of the line which differ from what's shown. */
+        ix = ln->dirtybeg;
+        while (TRUE) {
             unsigned char *ucx;
+            
+            for (; ix<ln->dirtyend; ix++) {
+                if (ln->chars[ix] != ln->shownchars[ix] 
+                    || ln->attrs[ix] != ln->shownattrs[ix])
+                    break;
+            }
+            if (ix >= ln->dirtyend)
+                break;
+            
+            /* find the end of the span, bridging short gaps. */
             beg = ix;
-            curattr = ln->attrs[beg];
-            for (ix++; ix<ln->dirtyend && ln->attrs[ix] == curattr; ix++) { }
-            attrset(win_textgrid_styleattrs[curattr]);
-            ucx = (unsigned char *)ln->chars; /* unsigned, so that addch() doesn't
-                get fed any high style bits. */
-            for (iix=beg; iix<ix; iix++) {
-                addch(ucx[iix]);
+            end = ix+1;
+            for (ix=end; ix<ln->dirtyend && ix<end+SPAN_GAP; ix++) {
+                if (ln->chars[ix] != ln->shownchars[ix] 
+                    || ln->attrs[ix] != ln->shownattrs[ix])
+                    end = ix+1;
+            }
+            
+            wmove(cwin, jx, beg);
+            gli_count_curses(1);
+            if (drawtop == -1)
+                drawtop = jx;
+            drawbottom = jx+1;
+            
+            ix = beg;
+            while (ix<end) {
+                beg = ix;
+                curattr = ln->attrs[beg];
+                for (ix++; ix<end && ln->attrs[ix] == curattr; ix++) { }
+                wattrset(cwin, win_textgrid_styleattrs[curattr]);
+                ucx = (unsigned char *)ln->chars; /* unsigned, so that waddch() 
+                    doesn't get fed any high style bits. */
+                for (iix=beg; iix<ix; iix++) {
+                    waddch(cwin, ucx[iix]);
+                    ln->shownchars[iix] = ucx[iix];
+                    ln->shownattrs[iix] = curattr;
+                }
+                gli_count_curses(1 + (ix-beg));
             }
         }
         
@@ -245,7 +357,12 @@ static void updatetext(window_textgrid_t *dwin, int drawall)
         ln->dirtyend = -1;
     }
     
-    attrset(0);
+    wattrset(cwin, 0);
+    gli_count_curses(1);
+    
+    if (drawtop != -1)
+        gli_damage_rect(orgx, orgy+drawtop, orgx+dwin->width, 
+            orgy+drawbottom);
     
     dwin->dirtybeg = -1;
     dwin->dirtyend = -1;
@@ -273,6 +390,35 @@ void win_textgrid_update(window_t *win)
     updatetext(dwin, FALSE);
 }
 
+/* Copy the damaged part of the window, box (in screen coordinates), into
+    the next screen update. If touch is set, something else may have drawn
+    over it, so copy all of it. Anything past the edge of the terminal 
+    (which can happen if -width or -height is too large) is left off. */
+void win_textgrid_flush(window_t *win, grect_t *box, int touch)
+{
+    window_textgrid_t *dwin = win->data;
+    int bottom, right;
+
+    if (!dwin->curswin)
+        return;
+    
+    bottom = box->bottom - 1;
+    if (bottom > LINES-1)
+        bottom = LINES-1;
+    right = box->right - 1;
+    if (right > COLS-1)
+        right = COLS-1;
+    if (bottom < box->top || right < box->left)
+        return;
+    
+    if (touch)
+        touchline(dwin->curswin, box->top - win->bbox.top, 
+            bottom+1 - box->top);
+    pnoutrefresh(dwin->curswin, box->top - win->bbox.top, 
+        box->left - win->bbox.left, box->top, box->left, bottom, right);
+    gli_count_curses(1);
+}
+
 void win_textgrid_putchar(window_t *win, char ch)
 {
     window_textgrid_t *dwin = win->data;
@@ -300,27 +446,102 @@ void win_textgrid_putchar(window_t *win, char ch)
     
     ln = &(dwin->lines[dwin->cury]);
     
-    setposdirty(dwin, ln, dwin->curx, dwin->cury);
-    
-    ln->chars[dwin->curx] = ch;
-    ln->attrs[dwin->curx] = win->style;
+    if (ln->chars[dwin->curx] != ch || ln->attrs[dwin->curx] != win->style) {
+        setposdirty(dwin, ln, dwin->curx, dwin->cury);
+        ln->chars[dwin->curx] = ch;
+        ln->attrs[dwin->curx] = win->style;
+    }
     
     dwin->curx++;
     /* We can leave the cursor outside the window, since it will be
         canonicalized next time a character is printed. */
 }
 
+/* Print a span of characters, with the same effect as calling 
+    win_textgrid_putchar() on each. The span is cut at newlines and at the
+    right edge of the window, and each piece is copied into its line at 
+    once. Only the cells which actually change are marked dirty. */
+void win_textgrid_putbuf(window_t *win, char *buf, long len)
+{
+    window_textgrid_t *dwin = win->data;
+    tgline_t *ln;
+    unsigned char style = win->style;
+    char *nl;
+    long count, beg, end;
+    
+    if (dwin->width <= 0) {
+        /* Nothing fits, but the cursor still moves down a line per
+            character. Let putchar sort it out. */
+        for (; len > 0; buf++, len--)
+            win_textgrid_putchar(win, *buf);
+        return;
+    }
+    
+    while (len > 0) {
+        /* Canonicalize the cursor position, as in win_textgrid_putchar(). */
+        if (dwin->curx < 0)
+            dwin->curx = 0;
+        else if (dwin->curx >= dwin->width) {
+            dwin->curx = 0;
+            dwin->cury++;
+        }
+        if (dwin->cury < 0)
+            dwin->cury = 0;
+        else if (dwin->cury >= dwin->height)
+            return; /* outside the window, and so is the rest */
+        
+        if (*buf == '\n') {
+            dwin->cury++;
+            dwin->curx = 0;
+            buf++;
+            len--;
+            continue;
+        }
+        
+        count = dwin->width - dwin->curx;
+        if (count > len)
+            count = len;
+        nl = memchr(buf, '\n', count);
+        if (nl)
+            count = nl - buf;
+        
+        ln = &(dwin->lines[dwin->cury]);
+        
+        for (beg=0; beg<count; beg++) {
+            if (ln->chars[dwin->curx+beg] != buf[beg] 
+                || ln->attrs[dwin->curx+beg] != style)
+                break;
+        }
+        if (beg < count) {
+            for (end=count; end>beg+1; end--) {
+                if (ln->chars[dwin->curx+end-1] != buf[end-1] 
+                    || ln->attrs[dwin->curx+end-1] != style)
+                    break;
+            }
+            memcpy(ln->chars+(dwin->curx+beg), buf+beg, end-beg);
+            memset(ln->attrs+(dwin->curx+beg), style, end-beg);
+            setposdirty(dwin, ln, dwin->curx+beg, dwin->cury);
+            setposdirty(dwin, ln, dwin->curx+end-1, dwin->cury);
+        }
+        
+        dwin->curx += count;
+        buf += count;
+        len -= count;
+    }
+}
+
 void win_textgrid_clear(window_t *win)
 {
-    int ix, jx;
+    int jx;
     window_textgrid_t *dwin = win->data;
     
+    if (dwin->chars) {
+        memset(dwin->chars, ' ', (long)dwin->height * dwin->stride);
+        memset(dwin->attrs, style_Normal, (long)dwin->height * dwin->stride);
+    }
+    
     for (jx=0; jx<dwin->height; jx++) {
         tgline_t *ln = &(dwin->lines[jx]);
-        for (ix=0; ix<dwin->width; ix++) {
-            ln->chars[ix] = ' ';
-            ln->attrs[ix] = style_Normal;
-        }
         ln->dirtybeg = 0;
         ln->dirtyend = dwin->width;
     }
@@ -371,6 +592,103 @@ void win_textgrid_place_cursor(window_t *win, int *xpos, int *ypos)
     *ypos = dwin->cury;
 }
 
+/* Write the window's cells, cursor, and line input state into a 
+    snapshot. See gtsnap.c. */
+void win_textgrid_save(window_t *win, gli_snapshot_t *snap)
+{
+    window_textgrid_t *dwin = win->data;
+    int jx;
+    
+    gli_snap_put_int(snap, dwin->width);
+    gli_snap_put_int(snap, dwin->height);
+    gli_snap_put_int(snap, dwin->curx);
+    gli_snap_put_int(snap, dwin->cury);
+    for (jx=0; jx<dwin->height; jx++) {
+        gli_snap_put_buffer(snap, dwin->lines[jx].chars, dwin->width);
+        gli_snap_put_buffer(snap, dwin->lines[jx].attrs, dwin->width);
+    }
+    
+    if (win->line_request) {
+        gli_snap_put_int(snap, dwin->inoriglen);
+        gli_snap_put_int(snap, dwin->inmax);
+        gli_snap_put_int(snap, dwin->inlen);
+        gli_snap_put_int(snap, dwin->incurs);
+        gli_snap_put_int(snap, dwin->inorgx);
+        gli_snap_put_int(snap, dwin->inorgy);
+        gli_snap_put_int(snap, dwin->inunicode);
+        gli_snap_put_int(snap, dwin->intermkeys);
+        gli_snap_put_int(snap, dwin->origstyle);
+        gli_snap_put_inbuf(snap, dwin->inbuf, dwin->inoriglen, 
+            dwin->inunicode, dwin->inarrayrock);
+    }
+}
+
+/* Read back what win_textgrid_save() wrote, into a new window. The cells
+    keep their places when the window is first laid out, as they would if
+    the window were resized. */
+void win_textgrid_load(window_t *win, gli_snapshot_t *snap)
+{
+    window_textgrid_t *dwin = win->data;
+    glui32 width, height;
+    int ix, jx;
+    
+    width = gli_snap_get_int(snap);
+    height = gli_snap_get_int(snap);
+    dwin->curx = gli_snap_get_int(snap);
+    dwin->cury = gli_snap_get_int(snap);
+    if (dwin->curx < 0 || dwin->cury < 0) {
+        dwin->curx = 0;
+        dwin->cury = 0;
+    }
+    if (snap->error || width > 0xFFFF || height > 0xFFFF
+        || (width && height > (snap->len - snap->pos) / (2 * width))) {
+        snap->error = TRUE;
+        return;
+    }
+    if (width && height) {
+        if (!grow_planes(dwin, width+1, height+1)) {
+            snap->error = TRUE;
+            return;
+        }
+        for (jx=0; jx<height; jx++) {
+            tgline_t *ln = &(dwin->lines[jx]);
+            gli_snap_get_buffer(snap, ln->chars, width);
+            gli_snap_get_buffer(snap, ln->attrs, width);
+            for (ix=0; ix<width; ix++) {
+                if (ln->attrs[ix] >= style_NUMSTYLES)
+                    ln->attrs[ix] = style_Normal;
+            }
+        }
+        dwin->width = width;
+        dwin->height = height;
+    }
+    
+    if (win->line_request) {
+        dwin->inoriglen = gli_snap_get_int(snap);
+        dwin->inmax = gli_snap_get_int(snap);
+        dwin->inlen = gli_snap_get_int(snap);
+        dwin->incurs = gli_snap_get_int(snap);
+        dwin->inorgx = gli_snap_get_int(snap);
+        dwin->inorgy = gli_snap_get_int(snap);
+        dwin->inunicode = (gli_snap_get_int(snap) != 0);
+        dwin->intermkeys = gli_snap_get_int(snap);
+        dwin->origstyle = gli_snap_get_int(snap);
+        if (snap->error || dwin->inoriglen < 0 || dwin->inmax < 0 
+            || dwin->inmax > dwin->inoriglen
+            || dwin->inorgx < 0 || dwin->inorgy < 0
+            || dwin->inorgy >= dwin->height 
+            || dwin->inorgx + dwin->inmax > dwin->width
+            || dwin->incurs < 0 || dwin->incurs > dwin->inlen 
+            || dwin->inlen > dwin->inmax
+            || dwin->origstyle >= style_NUMSTYLES) {
+            snap->error = TRUE;
+            return;
+        }
+        dwin->inbuf = gli_snap_get_inbuf(snap, dwin->inoriglen, 
+            dwin->inunicode, &dwin->inarrayrock);
+    }
+}
+
 /* Prepare the window for line input. */
 void win_textgrid_init_line(window_t *win, void *buf, int unicode,
     int maxlen, int initlen)
@@ -457,6 +775,7 @@ void win_textgrid_cancel_line(window_t *win, event_t *ev)
     ev->val1 = dwin->inlen;
     
     win->line_request = FALSE;
+    gli_window_input_changed(win);
     dwin->inbuf = NULL;
     dwin->inoriglen = 0;
     dwin->inmax = 0;
@@ -522,6 +841,7 @@ static void export_input_line(void *buf, int unicode, long len, char *chars)
 void gcmd_grid_accept_key(window_t *win, glui32 arg)
 {
     win->char_request = FALSE; 
+    gli_window_input_changed(win);
     arg = gli_input_from_native(arg);
     gli_event_store(evtype_CharInput, win, arg, 0);
 }
@@ -568,6 +888,7 @@ void gcmd_grid_accept_line(window_t *win, glui32 arg)
 
     gli_event_store(evtype_LineInput, win, dwin->inlen, termkey);
     win->line_request = FALSE;
+    gli_window_input_changed(win);
     dwin->inbuf = NULL;
     dwin->inoriglen = 0;
     dwin->inmax = 0;
@@ -4,22 +4,40 @@
     http://www.eblong.com/zarf/glk/index.html
 */
 
-/* One line of the window. */
+/* One line of the window. The arrays point into the window's cell planes;
+    only the first width entries of each are valid. */
 typedef struct tgline_struct {
-    int size; /* this is the allocated size; only width is valid */
     char *chars;
     unsigned char *attrs;
-    int dirtybeg, dirtyend; /* characters [dirtybeg, dirtyend) need to be redrawn */
+    char *shownchars; /* what was last drawn on the screen, the same size */
+    unsigned char *shownattrs; /* (or SHOWN_UNKNOWN if we don't know) */
+    int dirtybeg, dirtyend; /* characters [dirtybeg, dirtyend) need to be 
+        checked against the shown values, and redrawn if they differ */
 } tgline_t;
 
+/* A shownattrs value which never matches a real style, so that the cell
+    is always redrawn. */
+#define SHOWN_UNKNOWN (0xFF)
+
 typedef struct window_textgrid_struct {
     window_t *owner;
-    
+
+    WINDOW *curswin; /* the curses pad the cells are drawn into, or NULL
+        if the window is empty */
+
     int width, height;
     tgline_t *lines;
     int linessize; /* this is the allocated size of the lines array;
         only the first height entries are valid. */
     
+    /* The cells, stored row by row. Each plane holds linessize rows of
+        stride cells. */
+    int stride;
+    char *chars;
+    unsigned char *attrs;
+    char *shownchars;
+    unsigned char *shownattrs;
+    
     int curx, cury; /* the window cursor position */
     
     int dirtybeg, dirtyend; /* lines [dirtybeg, dirtyend) need to be redrawn */
@@ -42,10 +60,14 @@ extern void win_textgrid_destroy(window_textgrid_t *dwin);
 extern void win_textgrid_rearrange(window_t *win, grect_t *box);
 extern void win_textgrid_redraw(window_t *win);
 extern void win_textgrid_update(window_t *win);
+extern void win_textgrid_flush(window_t *win, grect_t *box, int touch);
 extern void win_textgrid_putchar(window_t *win, char ch);
+extern void win_textgrid_putbuf(window_t *win, char *buf, long len);
 extern void win_textgrid_clear(window_t *win);
 extern void win_textgrid_move_cursor(window_t *win, int xpos, int ypos);
 extern void win_textgrid_place_cursor(window_t *win, int *xpos, int *ypos);
+extern void win_textgrid_save(window_t *win, gli_snapshot_t *snap);
+extern void win_textgrid_load(window_t *win, gli_snapshot_t *snap);
 extern void win_textgrid_init_line(window_t *win, void *buf, int unicode, int maxlen, int initlen);
 extern void win_textgrid_cancel_line(window_t *win, event_t *ev);
 
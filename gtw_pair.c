@@ -176,7 +176,25 @@ void win_pair_rearrange(window_t *win, grect_t *box)
 
 void win_pair_redraw(window_t *win)
 {
-    int ix;
+    window_pair_t *dwin;
+    
+    if (!win)
+        return;
+        
+    dwin = win->data;
+
+    win_pair_redraw_border(win);
+    
+    gli_window_redraw(dwin->child1);
+    gli_window_redraw(dwin->child2);
+}
+
+/* Draw just the border between the two children, leaving the children
+    themselves alone. While a resize is settling, the box may run off the
+    screen, so the border is clipped to LINES and COLS. */
+void win_pair_redraw_border(window_t *win)
+{
+    int ix, lim;
     window_pair_t *dwin;
     
     if (!win)
@@ -186,33 +204,41 @@ void win_pair_redraw(window_t *win)
 
     if (dwin->vertical) {
         if (dwin->splitwidth) {
-            for (ix=win->bbox.top; ix<win->bbox.bottom; ix++) {
+            gli_damage_rect(dwin->splitpos, win->bbox.top-1, 
+                dwin->splitpos+1, win->bbox.bottom+1);
+            if (dwin->splitpos >= COLS)
+                return;
+            lim = (win->bbox.bottom < LINES) ? win->bbox.bottom : LINES;
+            for (ix=win->bbox.top; ix<lim; ix++) {
                 mvaddch(ix, dwin->splitpos, '|');
             }
-            if (win->bbox.top-1 >= 0) {
+            if (win->bbox.top-1 >= 0 && win->bbox.top-1 < LINES) {
                 mvaddch(win->bbox.top-1, dwin->splitpos, '+');
             }
-            if (win->bbox.bottom < content_box.bottom) {
+            if (win->bbox.bottom < content_box.bottom 
+                && win->bbox.bottom < LINES) {
                 mvaddch(win->bbox.bottom, dwin->splitpos, '+');
             }
         }
     }
     else {
         if (dwin->splitwidth) {
-            move(dwin->splitpos, win->bbox.left);
-            for (ix=win->bbox.left; ix<win->bbox.right; ix++) {
-                addch('-');
+            gli_damage_rect(win->bbox.left-1, dwin->splitpos, 
+                win->bbox.right+1, dwin->splitpos+1);
+            if (dwin->splitpos >= LINES)
+                return;
+            lim = (win->bbox.right < COLS) ? win->bbox.right : COLS;
+            for (ix=win->bbox.left; ix<lim; ix++) {
+                mvaddch(dwin->splitpos, ix, '-');
             }
-            if (win->bbox.left-1 >= 0) {
+            if (win->bbox.left-1 >= 0 && win->bbox.left-1 < COLS) {
                 mvaddch(dwin->splitpos, win->bbox.left-1, '+');
             }
-            if (win->bbox.right < content_box.right) {
+            if (win->bbox.right < content_box.right 
+                && win->bbox.right < COLS) {
                 mvaddch(dwin->splitpos, win->bbox.right, '+');
             }
         }
     }
-    
-    gli_window_redraw(dwin->child1);
-    gli_window_redraw(dwin->child2);
 }
 
@@ -29,3 +29,4 @@ extern window_pair_t *win_pair_create(window_t *win, glui32 method,
 extern void win_pair_destroy(window_pair_t *dwin);
 extern void win_pair_rearrange(window_t *win, grect_t *box);
 extern void win_pair_redraw(window_t *win);
+extern void win_pair_redraw_border(window_t *win);
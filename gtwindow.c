@@ -7,6 +7,7 @@
 #include "gtoption.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #ifdef OPT_USE_SIGNALS
 #include <signal.h>
@@ -20,8 +21,37 @@
 #include "gtw_grid.h"
 #include "gtw_buf.h"
 
-/* Linked list of all windows */
-static window_t *gli_windowlist = NULL; 
+#if defined(OPT_WINCHANGED_SIGNAL) && defined(NCURSES_VERSION)
+#include <sys/ioctl.h>
+#include <unistd.h>
+#define USE_RESIZE_TERM
+#endif /* OPT_WINCHANGED_SIGNAL && NCURSES_VERSION */
+
+/* All windows */
+static gli_pool_t windowpool = GLI_POOL_INIT(window_t, poolindex, poolgen);
+
+/* The damage list: screen rectangles which have been drawn into since
+    the last refresh(). Every piece of code that draws on stdscr reports
+    here, so an empty list means refresh() would have nothing to send.
+    When the list fills up, it collapses into a single bounding box. */
+#define NUMDAMAGE (8)
+static grect_t damagelist[NUMDAMAGE];
+static int numdamage = 0;
+
+/* The input index: every window which might have a binding for a key.
+    That's each text buffer (for scrolling and paging), and any other
+    window with a pending char or line request. Focus guessing and key
+    routing look only at these, rather than walking the whole tree. The
+    array is put in tree order (by treerank) when it's needed, and the
+    ranks are worked out again only after the tree changes shape. */
+static window_t **inputwins = NULL;
+static int numinputwins = 0;
+static int inputwinssize = 0;
+static int inputsorted = TRUE;
+static int treeranked = FALSE;
+
+/* Where gli_windows_place_cursor() last put the cursor. */
+static int cursorx = -1, cursory = -1;
 
 /* For use by gli_print_spaces() */
 #define NUMSPACES (16)
@@ -36,9 +66,17 @@ window_t *gli_focuswin = NULL; /* The window selected by the player.
 /* This is the screen region which is enclosed by the root window. */
 grect_t content_box;
 
+/* TRUE if curses has been started again on a new screen since the windows
+    were laid out, so their pads belong to the old one. */
+static int screen_replaced = FALSE;
+
 void (*gli_interrupt_handler)(void) = NULL;
 
 static void compute_content_box(void);
+static void gli_window_invalidate(window_t *win);
+static void gli_windows_redraw_moved(void);
+static void gli_window_redraw_moved(window_t *win);
+static void gli_windows_sort_input(void);
 
 #ifdef OPT_USE_SIGNALS
 
@@ -117,6 +155,9 @@ void gli_setup_curses()
     intrflush(stdscr, FALSE); 
     keypad(stdscr, TRUE);
     scrollok(stdscr, FALSE);
+    /* Let curses use the terminal's insert/delete-line capabilities,
+        unless the player has turned them off. */
+    idlok(stdscr, pref_hardware_scroll);
 }
 
 #ifdef OPT_USE_SIGNALS
@@ -136,15 +177,11 @@ static void gli_sig_interrupt(int val)
 
 #ifdef OPT_WINCHANGED_SIGNAL
 
-/* Signal handler for SIGWINCH. */
+/* Signal handler for SIGWINCH. The curses screen is replaced later, by
+    gli_windows_new_screen(), so that a burst of these signals costs
+    nothing. */
 static void gli_sig_winsize(int val)
 {
-    endwin();
-
-    newterm(getenv("TERM"), stdout, stdin);
-    gli_setup_curses();
-    gli_set_halfdelay();
-
     screen_size_changed = TRUE;
     signal(SIGWINCH, &gli_sig_winsize);
 }
@@ -196,7 +233,7 @@ static void compute_content_box()
 
 window_t *gli_new_window(glui32 type, glui32 rock)
 {
-    window_t *win = (window_t *)malloc(sizeof(window_t));
+    window_t *win = (window_t *)gli_pool_alloc(&windowpool);
     if (!win)
         return NULL;
     
@@ -213,17 +250,14 @@ window_t *gli_new_window(glui32 type, glui32 rock)
     win->echo_line_input = TRUE;
     win->terminate_line_input = 0;
     win->style = style_Normal;
+    win->inputindex = -1;
+    win->treerank = 0;
+    gli_window_invalidate(win);
+    win->moved = FALSE;
 
     win->str = gli_stream_open_window(win);
     win->echostr = NULL;
 
-    win->prev = NULL;
-    win->next = gli_windowlist;
-    gli_windowlist = win;
-    if (win->next) {
-        win->next->prev = win;
-    }
-    
     if (gli_register_obj)
         win->disprock = (*gli_register_obj)(win, gidisp_Class_Window);
     
@@ -232,12 +266,11 @@ window_t *gli_new_window(glui32 type, glui32 rock)
 
 void gli_delete_window(window_t *win)
 {
-    window_t *prev, *next;
-    
     if (gli_unregister_obj)
         (*gli_unregister_obj)(win, gidisp_Class_Window, win->disprock);
         
     win->magicnum = 0;
+    gli_window_input_changed(win);
     
     win->echostr = NULL;
     if (win->str) {
@@ -245,19 +278,7 @@ void gli_delete_window(window_t *win)
         win->str = NULL;
     }
     
-    prev = win->prev;
-    next = win->next;
-    win->prev = NULL;
-    win->next = NULL;
-
-    if (prev)
-        prev->next = next;
-    else
-        gli_windowlist = next;
-    if (next)
-        next->prev = prev;
-        
-    free(win);
+    gli_pool_release(&windowpool, win);
 }
 
 winid_t glk_window_open(winid_t splitwin, glui32 method, glui32 size, 
@@ -284,6 +305,10 @@ winid_t glk_window_open(winid_t splitwin, glui32 method, glui32 size,
             gli_strict_warning("window_open: ref must not be NULL");
             return 0;
         }
+        if (!gli_window_valid(splitwin)) {
+            gli_strict_warning("window_open: invalid ref");
+            return 0;
+        }
         
         val = (method & winmethod_DivisionMask);
         if (val != winmethod_Fixed && val != winmethod_Proportional) {
@@ -340,6 +365,11 @@ winid_t glk_window_open(winid_t splitwin, glui32 method, glui32 size,
         return 0;
     }
     
+    gli_window_input_changed(newwin);
+    /* The new window needs a rank. (Closing a window, or changing an
+        arrangement, leaves the others in the same order.) */
+    treeranked = FALSE;
+    
     if (!splitwin) {
         gli_rootwin = newwin;
         gli_window_rearrange(newwin, &box);
@@ -371,8 +401,9 @@ winid_t glk_window_open(winid_t splitwin, glui32 method, glui32 size,
         }
         
         gli_window_rearrange(pairwin, &box);
-        /* redraw the new pairwin and all its contents */
-        gli_window_redraw(pairwin);
+        /* redraw the new window, and whatever part of splitwin's subtree
+            changed shape */
+        gli_windows_redraw_moved();
     }
     
     return newwin;
@@ -430,7 +461,7 @@ static void gli_window_close(window_t *win, int recurse)
 
 void glk_window_close(window_t *win, stream_result_t *result)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_close: invalid ref");
         return;
     }
@@ -452,7 +483,7 @@ void glk_window_close(window_t *win, stream_result_t *result)
         grect_t box;
         window_t *pairwin, *sibwin, *grandparwin, *wx;
         window_pair_t *dpairwin, *dgrandparwin, *dwx;
-        int keydamage_flag;
+        window_t *keydamage_win;
         
         pairwin = win->parent;
         dpairwin = pairwin->data;
@@ -503,26 +534,37 @@ void glk_window_close(window_t *win, stream_result_t *result)
         /* Now we can delete the parent pair. */
         gli_window_close(pairwin, FALSE);
 
-        keydamage_flag = FALSE;
+        /* Find the highest pair which lost its key. Everything below it
+            may have to be re-split; everything above it is unaffected. */
+        keydamage_win = NULL;
         for (wx=sibwin; wx; wx=wx->parent) {
             if (wx->type == wintype_Pair) {
                 window_pair_t *dwx = wx->data;
                 if (dwx->keydamage) {
-                    keydamage_flag = TRUE;
+                    keydamage_win = wx;
                     dwx->keydamage = FALSE;
                 }
             }
         }
         
-        if (keydamage_flag) {
-            box = content_box;
-            gli_window_rearrange(gli_rootwin, &box);
-            gli_windows_redraw();
+        if (keydamage_win) {
+            /* The damaged pairs keep their boxes but change their splits,
+                so force the path from there down to sibwin to be laid out
+                again. Subtrees off that path are skipped if their boxes
+                come out the same. */
+            if (keydamage_win != sibwin)
+                box = keydamage_win->bbox;
+            for (wx=sibwin; wx; wx=wx->parent) {
+                gli_window_invalidate(wx);
+                if (wx == keydamage_win)
+                    break;
+            }
+            gli_window_rearrange(keydamage_win, &box);
         }
         else {
             gli_window_rearrange(sibwin, &box);
-            gli_window_redraw(sibwin);
         }
+        gli_windows_redraw_moved();
     }
 }
 
@@ -532,7 +574,7 @@ void glk_window_get_arrangement(window_t *win, glui32 *method, glui32 *size,
     window_pair_t *dwin;
     glui32 val;
     
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_arrangement: invalid ref");
         return;
     }
@@ -568,7 +610,7 @@ void glk_window_set_arrangement(window_t *win, glui32 method, glui32 size,
     grect_t box;
     int newvertical, newbackward;
     
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_set_arrangement: invalid ref");
         return;
     }
@@ -634,18 +676,22 @@ void glk_window_set_arrangement(window_t *win, glui32 method, glui32 size,
     dwin->vertical = (dwin->dir == winmethod_Left || dwin->dir == winmethod_Right);
     dwin->backward = (dwin->dir == winmethod_Left || dwin->dir == winmethod_Above);
     
+    /* The box is the same, but the split isn't. */
+    gli_window_invalidate(win);
     gli_window_rearrange(win, &box);
-    gli_window_redraw(win);
+    gli_windows_redraw_moved();
+}
+
+/* Squeeze closed windows out of the pool, so that each window's 
+    poolindex is its position in glk_window_iterate() order. */
+void gli_windows_compact()
+{
+    gli_pool_compact(&windowpool);
 }
 
 winid_t glk_window_iterate(winid_t win, glui32 *rock)
 {
-    if (!win) {
-        win = gli_windowlist;
-    }
-    else {
-        win = win->next;
-    }
+    win = gli_pool_next(&windowpool, win);
     
     if (win) {
         if (rock)
@@ -692,9 +738,130 @@ window_t *gli_window_iterate_treeorder(window_t *win)
     }
 }
 
-glui32 glk_window_get_rock(window_t *win)
+/* Add a window to the input index, or remove it, according to its type
+    and requests. This must be called whenever a window's char_request or
+    line_request changes, and when it is created and deleted. */
+void gli_window_input_changed(window_t *win)
+{
+    int wanted = FALSE;
+    
+    if (win->magicnum == MAGIC_WINDOW_NUM) {
+        switch (win->type) {
+            case wintype_TextBuffer:
+                wanted = TRUE;
+                break;
+            case wintype_TextGrid:
+                wanted = (win->char_request || win->line_request);
+                break;
+        }
+    }
+    
+    if (wanted && win->inputindex < 0) {
+        if (numinputwins >= inputwinssize) {
+            int newsize = (inputwinssize) ? inputwinssize * 2 : 8;
+            window_t **newwins = (window_t **)realloc(inputwins, 
+                newsize * sizeof(window_t *));
+            if (!newwins)
+                return;
+            inputwins = newwins;
+            inputwinssize = newsize;
+        }
+        win->inputindex = numinputwins;
+        inputwins[numinputwins++] = win;
+        inputsorted = FALSE;
+    }
+    else if (!wanted && win->inputindex >= 0) {
+        window_t *lastwin = inputwins[--numinputwins];
+        inputwins[win->inputindex] = lastwin;
+        lastwin->inputindex = win->inputindex;
+        win->inputindex = -1;
+        inputsorted = FALSE;
+    }
+}
+
+static int input_rank_compare(const void *p1, const void *p2)
+{
+    window_t *win1 = *(window_t **)p1;
+    window_t *win2 = *(window_t **)p2;
+    
+    if (win1->treerank < win2->treerank)
+        return -1;
+    if (win1->treerank > win2->treerank)
+        return 1;
+    return 0;
+}
+
+/* Put the input index in tree order, ranking the tree first if it has
+    changed shape. */
+static void gli_windows_sort_input()
+{
+    window_t *win;
+    glui32 rank;
+    int ix;
+    
+    if (!treeranked) {
+        rank = 0;
+        for (win=gli_window_iterate_treeorder(NULL); win; 
+            win=gli_window_iterate_treeorder(win))
+            win->treerank = rank++;
+        treeranked = TRUE;
+        inputsorted = FALSE;
+    }
+    
+    if (!inputsorted) {
+        qsort(inputwins, numinputwins, sizeof(window_t *), 
+            &input_rank_compare);
+        for (ix=0; ix<numinputwins; ix++)
+            inputwins[ix]->inputindex = ix;
+        inputsorted = TRUE;
+    }
+}
+
+/* Return the window in the input index which follows win in tree order,
+    wrapping around to the first. (win need not be in the index itself,
+    and may be NULL.) This returns NULL only if the index is empty. */
+window_t *gli_window_next_input(window_t *win)
 {
+    int ix, lo, hi;
+    
+    if (numinputwins == 0)
+        return NULL;
+    gli_windows_sort_input();
+    
     if (!win) {
+        ix = 0;
+    }
+    else if (win->inputindex >= 0) {
+        ix = win->inputindex + 1;
+    }
+    else {
+        /* Find the first window ranked after win. */
+        lo = 0;
+        hi = numinputwins;
+        while (lo < hi) {
+            ix = (lo + hi) / 2;
+            if (inputwins[ix]->treerank > win->treerank)
+                hi = ix;
+            else
+                lo = ix + 1;
+        }
+        ix = lo;
+    }
+    
+    if (ix >= numinputwins)
+        ix = 0;
+    return inputwins[ix];
+}
+
+/* The number of windows in the input index. */
+int gli_window_count_input()
+{
+    return numinputwins;
+}
+
+glui32 glk_window_get_rock(window_t *win)
+{
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_rock: invalid ref.");
         return 0;
     }
@@ -711,7 +878,7 @@ winid_t glk_window_get_root()
 
 winid_t glk_window_get_parent(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_parent: invalid ref");
         return 0;
     }
@@ -725,7 +892,7 @@ winid_t glk_window_get_sibling(window_t *win)
 {
     window_pair_t *dparwin;
     
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_sibling: invalid ref");
         return 0;
     }
@@ -742,7 +909,7 @@ winid_t glk_window_get_sibling(window_t *win)
 
 glui32 glk_window_get_type(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_parent: invalid ref");
         return 0;
     }
@@ -754,7 +921,7 @@ void glk_window_get_size(window_t *win, glui32 *width, glui32 *height)
     glui32 wid = 0;
     glui32 hgt = 0;
     
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_size: invalid ref");
         return;
     }
@@ -779,7 +946,7 @@ void glk_window_get_size(window_t *win, glui32 *width, glui32 *height)
 
 strid_t glk_window_get_stream(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_stream: invalid ref");
         return NULL;
     }
@@ -789,7 +956,7 @@ strid_t glk_window_get_stream(window_t *win)
 
 strid_t glk_window_get_echo_stream(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_get_echo_stream: invalid ref");
         return 0;
     }
@@ -824,17 +991,57 @@ void gli_windows_unechostream(stream_t *str)
 {
     window_t *win;
     
-    for (win=gli_windowlist; win; win=win->next) {
+    for (win=gli_pool_next(&windowpool, NULL); win;
+        win=gli_pool_next(&windowpool, win)) {
         if (win->echostr == str)
             win->echostr = NULL;
     }
 }
 
+/* Install a window tree which has been read back from a snapshot (see
+    gtsnap.c). The windows have their data and input requests, but have
+    never been laid out. The text they hold counts as already seen, so
+    there is no paging through it. */
+void gli_windows_restore_tree(window_t *root, window_t *focus)
+{
+    window_t *win;
+    
+    gli_rootwin = root;
+    gli_focuswin = focus;
+    
+    for (win=gli_pool_next(&windowpool, NULL); win;
+        win=gli_pool_next(&windowpool, win))
+        gli_window_input_changed(win);
+    treeranked = FALSE;
+    
+    gli_window_rearrange(gli_rootwin, &content_box);
+    gli_windows_update();
+    gli_windows_set_paging(TRUE);
+    gli_windows_redraw();
+}
+
 /* Some trivial switch functions which make up for the fact that we're not
     doing this in C++. */
 
+/* Forget a window's box, so that the next rearrange lays it out even if
+    it is handed the same box again. No real box has negative edges. */
+static void gli_window_invalidate(window_t *win)
+{
+    win->bbox.left = -1;
+    win->bbox.top = -1;
+    win->bbox.right = -1;
+    win->bbox.bottom = -1;
+}
+
 void gli_window_rearrange(window_t *win, grect_t *box)
 {
+    /* If the box hasn't changed, neither has anything inside it. */
+    if (box->left == win->bbox.left && box->top == win->bbox.top
+        && box->right == win->bbox.right && box->bottom == win->bbox.bottom)
+        return;
+    
+    win->moved = TRUE;
+    
     switch (win->type) {
         case wintype_Blank:
             win_blank_rearrange(win, box);
@@ -855,7 +1062,8 @@ void gli_windows_update()
 {
     window_t *win;
     
-    for (win=gli_windowlist; win; win=win->next) {
+    for (win=gli_pool_next(&windowpool, NULL); win;
+        win=gli_pool_next(&windowpool, win)) {
         switch (win->type) {
             case wintype_TextGrid:
                 win_textgrid_update(win);
@@ -869,10 +1077,15 @@ void gli_windows_update()
 
 void gli_window_redraw(window_t *win)
 {
+    win->moved = FALSE;
+    
     if (win->bbox.left >= win->bbox.right 
         || win->bbox.top >= win->bbox.bottom)
         return;
     
+    gli_damage_rect(win->bbox.left, win->bbox.top, 
+        win->bbox.right, win->bbox.bottom);
+    
     switch (win->type) {
         case wintype_Blank:
             win_blank_redraw(win);
@@ -889,6 +1102,35 @@ void gli_window_redraw(window_t *win)
     }
 }
 
+/* Redraw only the windows which were given new boxes since they were
+    last drawn. Borders are cheap, and a split that moved can leave a
+    stale corner mark on some other pair's border, so every border is
+    drawn again (parents first, as in a full redraw). */
+static void gli_windows_redraw_moved()
+{
+    if (gli_rootwin)
+        gli_window_redraw_moved(gli_rootwin);
+}
+
+static void gli_window_redraw_moved(window_t *win)
+{
+    window_pair_t *dwin;
+    
+    if (win->type != wintype_Pair) {
+        if (win->moved)
+            gli_window_redraw(win);
+        return;
+    }
+    
+    dwin = win->data;
+    win->moved = FALSE;
+    if (win->bbox.left < win->bbox.right 
+        && win->bbox.top < win->bbox.bottom)
+        win_pair_redraw_border(win);
+    gli_window_redraw_moved(dwin->child1);
+    gli_window_redraw_moved(dwin->child2);
+}
+
 void gli_windows_redraw()
 {
     int ix, jx;
@@ -900,31 +1142,86 @@ void gli_windows_redraw()
     else {
         /* There are no windows at all. */
         clear();
+        gli_damage_rect(0, 0, COLS, LINES);
         ix = (content_box.left+content_box.right) / 2 - 7;
         if (ix < 0)
             ix = 0;
         jx = (content_box.top+content_box.bottom) / 2;
+        if (jx > LINES-1)
+            jx = LINES-1;
+        if (ix > COLS-1)
+            ix = COLS-1;
         move(jx, ix);
         addstr("Please wait...");
     }
 }
 
-void gli_windows_size_change()
+/* Bring curses up to the terminal's new size, after it has been resized.
+    With ncurses the screen is resized in place, and the windows' pads
+    carry on as they are. Otherwise curses is started again on a new
+    screen, and every window's curses backing has to be built again. The
+    windows must be put back with gli_windows_size_change(). */
+void gli_windows_new_screen()
 {
-    compute_content_box();
+#ifdef USE_RESIZE_TERM
+    struct winsize ws;
+    
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0
+        && ws.ws_row > 0 && ws.ws_col > 0) {
+        resize_term(ws.ws_row, ws.ws_col);
+        /* The terminal may have rewrapped whatever it was showing. */
+        clearok(curscr, TRUE);
+        return;
+    }
+#endif /* USE_RESIZE_TERM */
+
+    endwin();
+
+    newterm(getenv("TERM"), stdout, stdin);
+    gli_setup_curses();
+    gli_set_halfdelay();
+    screen_replaced = TRUE;
+}
+
+/* Put the windows on the screen again after a size change. If settled is
+    FALSE, the size may still be changing; the windows keep their old
+    boxes and their pads, and are only redrawn, clipped to the new screen.
+    That is cheap, since no text has to be laid out again. When the size
+    has settled, this is called with settled TRUE, which rearranges 
+    everything to fit and sends an Arrange event. */
+void gli_windows_size_change(int settled)
+{
+    window_t *win;
+    
+    if (screen_replaced) {
+        /* The windows' curses backing went with the old screen, so lay
+            out every window afresh, even to the same box. */
+        for (win=gli_pool_next(&windowpool, NULL); win; 
+            win=gli_pool_next(&windowpool, win))
+            gli_window_invalidate(win);
+        screen_replaced = FALSE;
+    }
+    
+    if (settled)
+        compute_content_box();
     if (gli_rootwin) {
         gli_window_rearrange(gli_rootwin, &content_box);
     }
+    /* Whatever was on stdscr outside the windows is stale. */
+    erase();
+    gli_damage_rect(0, 0, COLS, LINES);
     gli_windows_redraw();
     gli_msgline_redraw();
     
-    gli_event_store(evtype_Arrange, NULL, 0, 0);
+    if (settled)
+        gli_event_store(evtype_Arrange, NULL, 0, 0);
 }
 
 void gli_windows_place_cursor()
 {
+    int xpos, ypos;
+    
     if (gli_rootwin && gli_focuswin) {
-        int xpos, ypos;
         xpos = 0;
         ypos = 0;
         switch (gli_focuswin->type) {
@@ -937,18 +1234,176 @@ void gli_windows_place_cursor()
             default:
                 break;
         }
-        move(gli_focuswin->bbox.top + ypos, gli_focuswin->bbox.left + xpos);
+        xpos += gli_focuswin->bbox.left;
+        ypos += gli_focuswin->bbox.top;
     }
     else {
-        move(content_box.bottom-1, content_box.right-1);
+        xpos = content_box.right-1;
+        ypos = content_box.bottom-1;
+    }
+    /* While a resize is settling, the windows may run off the screen. */
+    if (xpos > COLS-1)
+        xpos = COLS-1;
+    if (ypos > LINES-1)
+        ypos = LINES-1;
+    move(ypos, xpos);
+    
+    /* A cursor move is damage too, since only refresh() shows it. */
+    if (xpos != cursorx || ypos != cursory) {
+        gli_damage_rect(xpos, ypos, xpos+1, ypos+1);
+        cursorx = xpos;
+        cursory = ypos;
+    }
+}
+
+/* Report that a rectangle of the screen has been drawn into. */
+void gli_damage_rect(int left, int top, int right, int bottom)
+{
+    int ix;
+    grect_t *box;
+    
+    if (left >= right || top >= bottom)
+        return;
+    
+    for (ix=0; ix<numdamage; ix++) {
+        box = &(damagelist[ix]);
+        if (left >= box->left && right <= box->right
+            && top >= box->top && bottom <= box->bottom)
+            return; /* already covered */
+    }
+    
+    if (numdamage >= NUMDAMAGE) {
+        box = &(damagelist[0]);
+        for (ix=1; ix<numdamage; ix++) {
+            if (damagelist[ix].left < box->left)
+                box->left = damagelist[ix].left;
+            if (damagelist[ix].top < box->top)
+                box->top = damagelist[ix].top;
+            if (damagelist[ix].right > box->right)
+                box->right = damagelist[ix].right;
+            if (damagelist[ix].bottom > box->bottom)
+                box->bottom = damagelist[ix].bottom;
+        }
+        numdamage = 1;
+        if (left < box->left)
+            box->left = left;
+        if (top < box->top)
+            box->top = top;
+        if (right > box->right)
+            box->right = right;
+        if (bottom > box->bottom)
+            box->bottom = bottom;
+        return;
     }
+    
+    box = &(damagelist[numdamage++]);
+    box->left = left;
+    box->top = top;
+    box->right = right;
+    box->bottom = bottom;
+}
+
+/* Find the bounding box of the damage that falls inside bbox, and put 
+    it in box. Returns FALSE if there isn't any. */
+static int gli_damage_within(grect_t *bbox, grect_t *box)
+{
+    int ix, found;
+    grect_t *dbox;
+    
+    found = FALSE;
+    for (ix=0; ix<numdamage; ix++) {
+        dbox = &(damagelist[ix]);
+        if (dbox->right <= bbox->left || dbox->left >= bbox->right
+            || dbox->bottom <= bbox->top || dbox->top >= bbox->bottom)
+            continue;
+        if (!found) {
+            *box = *dbox;
+            found = TRUE;
+            continue;
+        }
+        if (dbox->left < box->left)
+            box->left = dbox->left;
+        if (dbox->top < box->top)
+            box->top = dbox->top;
+        if (dbox->right > box->right)
+            box->right = dbox->right;
+        if (dbox->bottom > box->bottom)
+            box->bottom = dbox->bottom;
+    }
+    if (!found)
+        return FALSE;
+    
+    if (box->left < bbox->left)
+        box->left = bbox->left;
+    if (box->top < bbox->top)
+        box->top = bbox->top;
+    if (box->right > bbox->right)
+        box->right = bbox->right;
+    if (box->bottom > bbox->bottom)
+        box->bottom = bbox->bottom;
+    return TRUE;
+}
+
+/* Place the cursor and bring the terminal up to date, if anything has
+    been drawn since the last time. Text buffer and grid windows draw into
+    their own curses windows, which are laid over stdscr (borders, blank
+    windows, and the message line) and sent to the terminal together. 
+    Only the damaged part of each window is copied; a window with no 
+    damage is left alone. */
+void gli_windows_flush()
+{
+    window_t *win;
+    grect_t box;
+    int ix, touch;
+    
+    gli_windows_place_cursor();
+    if (numdamage == 0)
+        return;
+    
+    /* If anything was drawn on stdscr, it may have been drawn over a
+        window, so the damaged part of each window has to be copied over
+        it again in full. Curses sends the whole run between the first and
+        last changed cells of each line, which may be wider than what was
+        reported, so those lines count as damaged right across. */
+    touch = FALSE;
+    for (ix=0; ix<LINES; ix++) {
+        if (is_linetouched(stdscr, ix)) {
+            gli_damage_rect(0, ix, COLS, ix+1);
+            touch = TRUE;
+        }
+    }
+    wnoutrefresh(stdscr);
+    gli_count_curses(1);
+    for (win=gli_pool_next(&windowpool, NULL); win; 
+        win=gli_pool_next(&windowpool, win)) {
+        if (win->type != wintype_TextBuffer 
+            && win->type != wintype_TextGrid)
+            continue;
+        if (!gli_damage_within(&win->bbox, &box))
+            continue;
+        switch (win->type) {
+            case wintype_TextBuffer:
+                win_textbuffer_flush(win, &box, touch);
+                break;
+            case wintype_TextGrid:
+                win_textgrid_flush(win, &box, touch);
+                break;
+        }
+    }
+    setsyx(cursory, cursorx);
+    doupdate();
+#ifdef OPT_CURSES_STATS
+    gli_curses_stats_frame();
+#endif /* OPT_CURSES_STATS */
+    numdamage = 0;
 }
 
 void gli_windows_set_paging(int forcetoend)
 {
     window_t *win;
     
-    for (win=gli_windowlist; win; win=win->next) {
+    for (win=gli_pool_next(&windowpool, NULL); win;
+        win=gli_pool_next(&windowpool, win)) {
         switch (win->type) {
             case wintype_TextBuffer:
                 win_textbuffer_set_paging(win, forcetoend);
@@ -961,7 +1416,8 @@ void gli_windows_trim_buffers()
 {
     window_t *win;
     
-    for (win=gli_windowlist; win; win=win->next) {
+    for (win=gli_pool_next(&windowpool, NULL); win;
+        win=gli_pool_next(&windowpool, win)) {
         switch (win->type) {
             case wintype_TextBuffer:
                 win_textbuffer_trim_buffer(win);
@@ -972,7 +1428,7 @@ void gli_windows_trim_buffers()
 
 void glk_request_char_event(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("request_char_event: invalid ref");
         return;
     }
@@ -993,12 +1449,13 @@ void glk_request_char_event(window_t *win)
             break;
     }
     
+    gli_window_input_changed(win);
 }
 
 void glk_request_line_event(window_t *win, char *buf, glui32 maxlen, 
     glui32 initlen)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("request_line_event: invalid ref");
         return;
     }
@@ -1024,13 +1481,14 @@ void glk_request_line_event(window_t *win, char *buf, glui32 maxlen,
             break;
     }
     
+    gli_window_input_changed(win);
 }
 
 #ifdef GLK_MODULE_UNICODE
 
 void glk_request_char_event_uni(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("request_char_event: invalid ref");
         return;
     }
@@ -1051,12 +1509,13 @@ void glk_request_char_event_uni(window_t *win)
             break;
     }
     
+    gli_window_input_changed(win);
 }
 
 void glk_request_line_event_uni(window_t *win, glui32 *buf, glui32 maxlen, 
     glui32 initlen)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("request_line_event: invalid ref");
         return;
     }
@@ -1082,13 +1541,14 @@ void glk_request_line_event_uni(window_t *win, glui32 *buf, glui32 maxlen,
             break;
     }
     
+    gli_window_input_changed(win);
 }
 
 #endif /* GLK_MODULE_UNICODE */
 
 void glk_request_mouse_event(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("request_mouse_event: invalid ref");
         return;
     }
@@ -1100,7 +1560,7 @@ void glk_request_mouse_event(window_t *win)
 
 void glk_cancel_char_event(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("cancel_char_event: invalid ref");
         return;
     }
@@ -1109,6 +1569,7 @@ void glk_cancel_char_event(window_t *win)
         case wintype_TextBuffer:
         case wintype_TextGrid:
             win->char_request = FALSE;
+            gli_window_input_changed(win);
             break;
         default:
             /* do nothing */
@@ -1126,7 +1587,7 @@ void glk_cancel_line_event(window_t *win, event_t *ev)
 
     gli_event_clearevent(ev);
     
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("cancel_line_event: invalid ref");
         return;
     }
@@ -1150,7 +1611,7 @@ void glk_cancel_line_event(window_t *win, event_t *ev)
 
 void glk_cancel_mouse_event(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("cancel_mouse_event: invalid ref");
         return;
     }
@@ -1192,9 +1653,68 @@ void gli_window_put_char(window_t *win, char ch)
     }
 }
 
+/* Hand a span of native characters to a window. */
+static void put_native_buffer(window_t *win, char *buf, long len)
+{
+    switch (win->type) {
+        case wintype_TextBuffer:
+            win_textbuffer_putbuf(win, buf, len);
+            break;
+        case wintype_TextGrid:
+            win_textgrid_putbuf(win, buf, len);
+            break;
+    }
+}
+
+/* Print a span of characters to a window. This does the same conversion
+    as gli_window_put_char(), but the window receives the result in a few
+    large pieces rather than one character at a time. */
+void gli_window_put_buffer(window_t *win, char *buf, glui32 len)
+{
+    char outbuf[256];
+    int outlen = 0;
+    char *altstr;
+    unsigned char ch;
+    glui32 lx;
+    
+    if (win->type != wintype_TextBuffer && win->type != wintype_TextGrid)
+        return;
+    
+    for (lx=0; lx<len; lx++) {
+        /* The longest ASCII equivalent is four characters, so make sure
+            there's room for that. */
+        if (outlen + 4 > sizeof(outbuf)) {
+            put_native_buffer(win, outbuf, outlen);
+            outlen = 0;
+        }
+        
+        ch = (unsigned char)buf[lx];
+        if (char_printable_table[ch]) {
+#ifndef OPT_NATIVE_LATIN_1  
+            ch = char_to_native_table[ch];
+#endif /* OPT_NATIVE_LATIN_1 */
+            outbuf[outlen++] = ch;
+            continue;
+        }
+        
+        /* As in gli_window_put_char(), the equivalent contains only 
+            characters in the range 0x20..0x7E. */
+        for (altstr = gli_ascii_equivalent(ch); *altstr; altstr++) {
+            ch = (unsigned char)*altstr;
+#ifndef OPT_NATIVE_LATIN_1  
+            ch = char_to_native_table[ch];
+#endif /* OPT_NATIVE_LATIN_1 */
+            outbuf[outlen++] = ch;
+        }
+    }
+    
+    if (outlen)
+        put_native_buffer(win, outbuf, outlen);
+}
+
 void glk_window_clear(window_t *win)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_clear: invalid ref");
         return;
     }
@@ -1216,7 +1736,7 @@ void glk_window_clear(window_t *win)
 
 void glk_window_move_cursor(window_t *win, glui32 xpos, glui32 ypos)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("window_move_cursor: invalid ref");
         return;
     }
@@ -1235,19 +1755,53 @@ void gli_print_spaces(int len)
 {
     while (len >= NUMSPACES) {
         addstr(spacebuffer);
+        gli_count_curses(1);
         len -= NUMSPACES;
     }
     
     if (len > 0) {
         addstr(&(spacebuffer[NUMSPACES - len]));
+        gli_count_curses(1);
     }
 }
 
+#ifdef OPT_CURSES_STATS
+
+/* Curses calls made to draw windows since the last screen update. */
+long gli_curses_calls = 0;
+
+static long curses_stats_frames = 0;
+static long curses_stats_total = 0;
+static long curses_stats_max = 0;
+
+/* Called after each screen update, to fold the current count into the
+    totals. */
+void gli_curses_stats_frame()
+{
+    if (!gli_curses_calls)
+        return;
+    curses_stats_frames++;
+    curses_stats_total += gli_curses_calls;
+    if (gli_curses_calls > curses_stats_max)
+        curses_stats_max = gli_curses_calls;
+    gli_curses_calls = 0;
+}
+
+/* Called after endwin(). */
+void gli_curses_stats_report()
+{
+    gli_curses_stats_frame();
+    printf("%ld curses calls in %ld screen updates (at most %ld in one)\n",
+        curses_stats_total, curses_stats_frames, curses_stats_max);
+}
+
+#endif /* OPT_CURSES_STATS */
+
 #ifdef GLK_MODULE_LINE_ECHO
 
 void glk_set_echo_line_event(window_t *win, glui32 val)
 {
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("set_echo_line_event: invalid ref");
         return;
     }
@@ -1265,7 +1819,7 @@ void glk_set_terminators_line_event(window_t *win, glui32 *keycodes,
     int ix;
     glui32 res, val;
 
-    if (!win) {
+    if (!gli_window_valid(win)) {
         gli_strict_warning("set_terminators_line_event: invalid ref");
         return;
     }
@@ -1310,7 +1864,8 @@ void gcmd_win_refresh(window_t *win, glui32 arg)
     clear();
     gli_windows_redraw();
     gli_msgline_redraw();
-    wrefresh(curscr);
+    /* clear() makes the next update repaint the whole terminal. */
+    gli_windows_flush();
 }
 
 #ifdef GLK_MODULE_IMAGE
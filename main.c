@@ -24,7 +24,11 @@ int pref_override_window_borders = FALSE;
 int pref_window_borders = FALSE;
 int pref_precise_timing = FALSE;
 int pref_historylen = 20;
+int pref_scrollback = 5000;
+int pref_layoutcache = 256;
 int pref_prompt_defaults = TRUE;
+int pref_hardware_scroll = TRUE;
+int pref_resize_delay = 250;
 
 /* Some constants for my wacky little command-line option parser. */
 #define ex_Void (0)
@@ -155,6 +159,18 @@ int main(int argc, char *argv[])
             pref_historylen = val;
         else if (extract_value(argc, argv, "hl", ex_Int, &ix, &val, 20))
             pref_historylen = val;
+        else if (extract_value(argc, argv, "scrollback", ex_Int, &ix, &val, 5000)) {
+            if (val < 100 || val > 1000000) {
+                printf("%s: -scrollback must be between 100 and 1000000\n", argv[0]);
+                errflag = TRUE;
+            }
+            else
+                pref_scrollback = val;
+        }
+        else if (extract_value(argc, argv, "layoutcache", ex_Int, &ix, &val, 256))
+            pref_layoutcache = val;
+        else if (extract_value(argc, argv, "hwscroll", ex_Bool, &ix, &val, pref_hardware_scroll))
+            pref_hardware_scroll = val;
         else if (extract_value(argc, argv, "width", ex_Int, &ix, &val, 80))
             pref_screenwidth = val;
         else if (extract_value(argc, argv, "w", ex_Int, &ix, &val, 80))
@@ -177,6 +193,10 @@ int main(int argc, char *argv[])
         else if (extract_value(argc, argv, "precise", ex_Bool, &ix, &val, pref_precise_timing))
             pref_precise_timing = val;
 #endif /* !OPT_TIMED_INPUT */
+#if defined(OPT_TIMED_INPUT) && defined(OPT_WINCHANGED_SIGNAL)
+        else if (extract_value(argc, argv, "resizedelay", ex_Int, &ix, &val, 250))
+            pref_resize_delay = val;
+#endif /* OPT_TIMED_INPUT && OPT_WINCHANGED_SIGNAL */
         else {
             printf("%s: unknown option: %s\n", argv[0], argv[ix]);
             errflag = TRUE;
@@ -208,12 +228,18 @@ int main(int argc, char *argv[])
         printf("  -height NUM: manual screen height (ditto)\n");
         printf("  -ml BOOL: use message line (default 'yes')\n");
         printf("  -historylen NUM: length of command history (default 20)\n");
+        printf("  -scrollback NUM: characters of text kept in each buffer window (100 to 1000000; default 5000)\n");
+        printf("  -layoutcache NUM: kilobytes of layout kept per buffer window, for resizing (default 256)\n");
         printf("  -revgrid BOOL: reverse text in grid (status) windows (default 'no')\n");
         printf("  -border BOOL: force borders/no borders between windows\n");
         printf("  -defprompt BOOL: provide defaults for file prompts (default 'yes')\n");
+        printf("  -hwscroll BOOL: let curses use insert/delete-line (default 'yes')\n");
 #ifdef OPT_TIMED_INPUT
         printf("  -precise BOOL: more precise timing for timed input (burns more CPU time) (default 'no')\n");
 #endif /* !OPT_TIMED_INPUT */
+#if defined(OPT_TIMED_INPUT) && defined(OPT_WINCHANGED_SIGNAL)
+        printf("  -resizedelay NUM: milliseconds to wait for a resize to finish before rearranging (default 250)\n");
+#endif /* OPT_TIMED_INPUT && OPT_WINCHANGED_SIGNAL */
         printf("  -version: display Glk library version\n");
         printf("  -help: display this list\n");
         printf("NUM values can be any number. BOOL values can be 'yes' or 'no', or no value to toggle.\n");